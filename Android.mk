@@ -11,10 +11,12 @@ LOCAL_SRC_FILES := \
   src/face_detect.cc \
   src/group_rectangle.cc \
   src/integral_image.cc \
-  src/lbp_detect.cc
+  src/lbp_detect.cc \
+  src/thread_pool.cc
 
 LOCAL_SRC_FILES_x86 := \
-  src/lbp_detect_sse2.cc
+  src/lbp_detect_sse2.cc \
+  src/integral_image_sse2.cc
 
 # x86_64 uses the same source as x86.
 LOCAL_SRC_FILES_x86_64 := $(LOCAL_SRC_FILES_x86)
@@ -24,6 +26,7 @@ LOCAL_CFLAGS += \
   -Wno-endif-labels \
   -Wno-import \
   -Wno-format \
+  -ffp-contract=off \
 
 #LOCAL_C_INCLUDES += $(LOCAL_PATH) external/jpeg
 
@@ -41,3 +44,14 @@ LOCAL_SHARED_LIBRARIES := libfaceldp
 LOCAL_C_INCLUDES += $(LOCAL_PATH)/src
 LOCAL_LDLIBS := -llog
 include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_SRC_FILES := \
+  examples/facelbp_bench.cc
+LOCAL_MODULE:= facelbp_bench
+LOCAL_MODULE_TAGS := eng
+LOCAL_SHARED_LIBRARIES := libfaceldp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/src
+LOCAL_LDLIBS := -llog
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,201 @@
+/*
+ * facelbp - Face detection using Multi-scale Block Local Binary Pattern algorithm
+ *
+ * Copyright (C) 2013 Keith Mok <ek9852@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Compares the cache and TLB misses of full scans column by column and block by block.
+ * The counters only see the calling thread, so it scans with one thread by default. */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+#include "face_detect.h"
+
+enum {
+    COUNTER_CACHE_MISSES,
+    COUNTER_L1D_MISSES,
+    COUNTER_DTLB_MISSES,
+    NUM_COUNTERS
+};
+
+static const char *counter_names[NUM_COUNTERS] = { "cache misses", "L1d misses", "dTLB misses" };
+
+/* -1 where the counter cannot be opened */
+static void
+open_counters(int *fd)
+{
+    int i;
+
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        fd[i] = -1;
+#ifdef __linux__
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        switch (i) {
+        case COUNTER_CACHE_MISSES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case COUNTER_L1D_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case COUNTER_DTLB_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        }
+        fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+}
+
+static void
+enable_counters(const int *fd, int enable)
+{
+#ifdef __linux__
+    int i;
+
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        if (fd[i] < 0)
+            continue;
+        if (enable)
+            ioctl(fd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd[i], enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+    }
+#endif
+}
+
+/* runs frames full scans, prints the time and the misses per frame */
+static int
+bench(struct face_det *det, unsigned char *y, int frames, const int *fd, const char *name,
+        struct face *f, int *num_faces)
+{
+    struct timeval start, end;
+    long long count;
+    int i;
+
+    /* warm up, the first scan also creates the threads */
+    *num_faces = 30;
+    face_detector_detect(det, y, f, num_faces);
+
+    enable_counters(fd, 1);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < frames; i++) {
+        *num_faces = 30;
+        face_detector_detect(det, y, f, num_faces);
+    }
+    gettimeofday(&end, NULL);
+    enable_counters(fd, 0);
+
+    printf("%-8s %8.1f ms", name,
+            ((end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0) / frames);
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        if (fd[i] >= 0 && read(fd[i], &count, sizeof(count)) == sizeof(count))
+            printf("  %s %lld", counter_names[i], count / frames);
+        else
+            printf("  %s n/a", counter_names[i]);
+    }
+    printf("\n");
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *prog = argv[0];
+    int frames = 10, threads = 1;
+
+    for (;;) {
+        if (argc > 2 && !strcmp(argv[1], "-n")) {
+            frames = atoi(argv[2]);
+        } else if (argc > 2 && !strcmp(argv[1], "-t")) {
+            threads = atoi(argv[2]);
+        } else {
+            break;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc != 4 || frames < 1 || threads < 0) {
+        fprintf(stderr, "Usage: %s [-n frames] [-t threads] <width> <height> <image.y>\n", prog);
+        return 1;
+    }
+
+    int width = atoi(argv[1]), height = atoi(argv[2]);
+    if ((width <= 0) || (height <= 0)) {
+        fprintf(stderr, "width/height invalid\n");
+        return 1;
+    }
+
+    unsigned char *y = (unsigned char *)malloc((size_t)width * height);
+    int fd = open(argv[3], O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open file: %s\n", argv[3]);
+        return 1;
+    }
+    if (read(fd, y, (size_t)width * height) != (ssize_t)width * height) {
+        fprintf(stderr, "Error reading file: %s\n", argv[3]);
+        return 1;
+    }
+    close(fd);
+
+    struct face_det *det = face_detector_create(width, height, 24);
+    if (!det) {
+        fprintf(stderr, "init face detector error\n");
+        return 1;
+    }
+    face_detector_set_threads(det, threads);
+
+    int counters[NUM_COUNTERS];
+    open_counters(counters);
+
+    struct face columns[30], blocks[30];
+    int num_columns, num_blocks;
+
+    bench(det, y, frames, counters, "columns", columns, &num_columns);
+    if (face_detector_set_block_scan(det, FACE_BLOCK_L2)) {
+        fprintf(stderr, "Cannot scan block by block\n");
+        return 1;
+    }
+    bench(det, y, frames, counters, "blocks", blocks, &num_blocks);
+
+    face_detector_destroy(det);
+    free(y);
+
+    if (num_columns != num_blocks || memcmp(columns, blocks, num_columns * sizeof(struct face))) {
+        printf("Faces differ: %d column by column, %d block by block\n", num_columns, num_blocks);
+        return 1;
+    }
+    printf("Faces: %d, the same both ways\n", num_columns);
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include <gst/gst.h>
 #include <math.h>
 #include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
 #include <clutter/clutter.h>
 #include <clutter-gst/clutter-gst.h>
 #include <clutter-gtk/clutter-gtk.h>
@@ -13,7 +14,7 @@
 #include "face_detect.h"
 
 #define MAX_FACES 10
-#define DETECT_SKIP 10
+#define SCAN_SLICES 10
 
 struct face_detector {
   struct face_det *det;
@@ -124,6 +125,27 @@ eos (GstAppSink *appsink, gpointer user_data)
   }
 }
 
+/* formats the detector reads directly, videoconvert only steps in for anything else */
+#define APPSINK_CAPS "video/x-raw, format=(string){ GRAY8, NV12, I420, YUY2, UYVY, RGB, BGR, RGBA, BGRA, RGBx, BGRx }"
+
+static enum face_format
+to_face_format (GstVideoFormat format)
+{
+  switch (format) {
+    case GST_VIDEO_FORMAT_NV12: return FACE_FORMAT_NV12;
+    case GST_VIDEO_FORMAT_I420: return FACE_FORMAT_I420;
+    case GST_VIDEO_FORMAT_YUY2: return FACE_FORMAT_YUYV;
+    case GST_VIDEO_FORMAT_UYVY: return FACE_FORMAT_UYVY;
+    case GST_VIDEO_FORMAT_RGB: return FACE_FORMAT_RGB;
+    case GST_VIDEO_FORMAT_BGR: return FACE_FORMAT_BGR;
+    case GST_VIDEO_FORMAT_RGBA:
+    case GST_VIDEO_FORMAT_RGBx: return FACE_FORMAT_RGBA;
+    case GST_VIDEO_FORMAT_BGRA:
+    case GST_VIDEO_FORMAT_BGRx: return FACE_FORMAT_BGRA;
+    default: return FACE_FORMAT_GRAY;
+  }
+}
+
 static GstFlowReturn
 new_sample (GstAppSink *appsink, gpointer user_data)
 {
@@ -131,6 +153,8 @@ new_sample (GstAppSink *appsink, gpointer user_data)
   GstBuffer *buf;
   GstMapInfo map;
   GstCaps *caps;
+  GstVideoInfo info;
+  struct face_frame frame;
   gint width, height;
   gboolean result;
   struct face_detector *f = (struct face_detector *)user_data;
@@ -146,6 +170,10 @@ new_sample (GstAppSink *appsink, gpointer user_data)
   if (!result)
     return GST_FLOW_OK;
 
+  /* rows are padded, scan the luma (or packed) plane of the mapped buffer in place */
+  if (!gst_video_info_from_caps (&info, caps))
+    return GST_FLOW_OK;
+
   if (f->det != NULL) {
     if ((f->width != width) || (f->height != height)) {
         face_detector_destroy(f->det);
@@ -158,6 +186,8 @@ new_sample (GstAppSink *appsink, gpointer user_data)
     f->det = face_detector_create(width, height, height/6);
     if (!f->det)
       g_error("Cannot create face_detector_create");
+    /* new faces show up within SCAN_SLICES frames, no frame scans everything */
+    face_detector_set_scan_slices(f->det, SCAN_SLICES);
     f->width = width;
     f->height = height;
   }
@@ -166,15 +196,16 @@ new_sample (GstAppSink *appsink, gpointer user_data)
   buf = gst_sample_get_buffer (sample);
   gst_buffer_map (buf, &map, GST_MAP_READ);
 
+  frame.data = map.data + GST_VIDEO_INFO_PLANE_OFFSET (&info, 0);
+  frame.stride = GST_VIDEO_INFO_PLANE_STRIDE (&info, 0);
+  frame.x = 0;
+  frame.y = 0;
+  frame.format = to_face_format (GST_VIDEO_INFO_FORMAT (&info));
+
   g_mutex_lock(&f->mutex);
 
   faces = MAX_FACES;
-  if ((f->detected_faces) && (f->frames % DETECT_SKIP)) {
-    face_detector_tracking(f->det, map.data, f->fa, f->detected_faces, &faces);
-printf("tracking\n");
-  } else {
-    face_detector_detect(f->det, map.data, f->fa, &faces);
-  }
+  face_detector_process_frame(f->det, &frame, f->fa, f->detected_faces, &faces);
   f->detected_faces = faces;
 if (faces) {
 int i;
@@ -386,9 +417,7 @@ main (int argc, char **argv)
   queue[0] = gst_element_factory_make ("queue", NULL);
   queue[1] = gst_element_factory_make ("queue", NULL);
   appsink = gst_element_factory_make ("appsink", NULL);
-  caps = gst_caps_new_simple ("video/x-raw",
-              "format", G_TYPE_STRING, "GRAY8",
-              NULL);
+  caps = gst_caps_from_string (APPSINK_CAPS);
   gst_app_sink_set_caps(GST_APP_SINK(appsink), caps);
   gst_caps_unref (caps);
 
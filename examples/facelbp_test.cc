@@ -22,16 +22,506 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <algorithm>
 #include "face_detect.h"
+#include "integral_image.h"
+
+static const char *engine_names[] = { "float", "fixed", "drift", "pyramid" };
+
+static bool
+same_faces(const struct face *a, int na, const struct face *b, int nb)
+{
+    return na == nb && !memcmp(a, b, na * sizeof(*a));
+}
+
+/* every integral row kernel the cpu runs must match the plain c reference bit for bit,
+ * at widths that are odd or leave a tail after the last full vector */
+static int
+check_integral(void)
+{
+    static const int widths[] = { 1, 7, 15, 16, 17, 31, 33, 47, 63, 65, 131, 641 };
+    const int max_width = 641, height = 5;
+    unsigned char data[max_width * height];
+    unsigned int ref[max_width * height], out[max_width * height];
+    unsigned int w;
+    int k, i, ret = 0;
+
+    srand(1);
+    for (i = 0; i < max_width * height; i++)
+        data[i] = i % 13 ? rand() & 0xff : 255;
+
+    for (w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        int width = widths[w];
+        face_detector_gen_integral_image_ref(ref, data, width, height);
+        for (k = 0; k < num_integral_row_kernels; k++) {
+            for (i = 0; i < height; i++)
+                integral_row_kernels[k].row(out + i * width, i ? out + (i - 1) * width : NULL, data + i * width, width);
+            if (memcmp(ref, out, width * height * sizeof(unsigned int))) {
+                printf("Integral image: %s differs from the reference at width %d\n", integral_row_kernels[k].name, width);
+                ret = -1;
+            }
+        }
+    }
+    if (!ret) {
+        printf("Integral image:");
+        for (k = 0; k < num_integral_row_kernels; k++)
+            printf(" %s", integral_row_kernels[k].name);
+        printf(" match the reference\n");
+    }
+    return ret;
+}
+
+static const char *format_names[] = { "gray", "nv12", "i420", "yuyv", "uyvy", "rgb", "bgr", "rgba", "bgra" };
+
+/* every luma kernel must give the bytes of the plain c one of its format, and every
+ * format integrated with every integral row kernel from rows padded past the width must
+ * match the reference integral image of its luma, at the widths of check_integral */
+static int
+check_luma(void)
+{
+    static const int widths[] = { 1, 7, 15, 16, 17, 31, 33, 47, 63, 65, 131, 641 };
+    const int max_width = 641, height = 5;
+    const int stride = max_width * 4 + 13, i_stride = max_width + 3;
+    unsigned char data[stride * height], luma[max_width * height], row[max_width];
+    unsigned int ref[max_width * height], out[i_stride * height];
+    integral_row_t integral_row = pf_integral_row;
+    unsigned int w;
+    int format, k, i, ret = 0;
+
+    srand(2);
+    for (i = 0; i < stride * height; i++)
+        data[i] = i % 13 ? rand() & 0xff : 255;
+
+    for (format = FACE_FORMAT_GRAY; format < FACE_FORMAT_MAX; format++) {
+        enum face_format fmt = (enum face_format)format;
+        luma_row_t plain_c = NULL;
+
+        for (k = 0; k < num_luma_row_kernels && !plain_c; k++) {
+            if (luma_row_kernels[k].format == fmt)
+                plain_c = luma_row_kernels[k].row;
+        }
+        for (w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+            int width = widths[w];
+
+            /* planar formats integrate their luma plane as is */
+            for (i = 0; i < height; i++) {
+                if (plain_c)
+                    plain_c(luma + i * width, data + i * stride, width);
+                else
+                    memcpy(luma + i * width, data + i * stride, width);
+            }
+            face_detector_gen_integral_image_ref(ref, luma, width, height);
+
+            for (k = 0; k < num_luma_row_kernels; k++) {
+                if (luma_row_kernels[k].format != fmt)
+                    continue;
+                for (i = 0; i < height; i++) {
+                    luma_row_kernels[k].row(row, data + i * stride, width);
+                    if (memcmp(row, luma + i * width, width))
+                        break;
+                }
+                if (i < height) {
+                    printf("Luma: %s %s differs from the plain c at width %d\n",
+                            luma_row_kernels[k].name, format_names[format], width);
+                    ret = -1;
+                }
+            }
+            for (k = 0; k < num_integral_row_kernels; k++) {
+                pf_integral_row = integral_row_kernels[k].row;
+                face_detector_gen_integral_image_team(out, i_stride, data, stride, fmt, width, height, row, 1);
+                for (i = 0; i < height; i++) {
+                    if (memcmp(out + i * i_stride, ref + i * width, width * sizeof(unsigned int)))
+                        break;
+                }
+                if (i < height) {
+                    printf("Luma: %s integral image of %s differs from the reference at width %d\n",
+                            integral_row_kernels[k].name, format_names[format], width);
+                    ret = -1;
+                }
+            }
+        }
+    }
+    pf_integral_row = integral_row;
+    if (!ret) {
+        printf("Luma:");
+        for (k = 0; k < num_luma_row_kernels; k++)
+            printf(" %s %s", luma_row_kernels[k].name, format_names[luma_row_kernels[k].format]);
+        printf(" match the plain c, every format integrates at padded strides\n");
+    }
+    return ret;
+}
+
+/* detects and tracks with 1 to max_threads threads, the faces must not change */
+static int
+check_threads(struct face_det *det, unsigned char *y, int max_threads)
+{
+    struct face ref_detect[30], ref_track[30], f[30], t[30];
+    struct face_eval_stats stats;
+    int ref_detected = 30, ref_tracked = 30;
+    int n, detected, tracked, ret = 0;
+
+    for (n = 1; n <= max_threads; n++) {
+        if (face_detector_set_threads(det, n))
+            return -1;
+        detected = 30;
+        face_detector_detect(det, y, f, &detected);
+        memcpy(t, f, sizeof(f));
+        tracked = 30;
+        face_detector_tracking(det, y, t, detected, &tracked);
+        if (n == 1) {
+            memcpy(ref_detect, f, sizeof(f));
+            memcpy(ref_track, t, sizeof(t));
+            ref_detected = detected;
+            ref_tracked = tracked;
+        } else if (!same_faces(ref_detect, ref_detected, f, detected) ||
+                !same_faces(ref_track, ref_tracked, t, tracked)) {
+            printf("Threads %d: %d faces detected, %d tracked, differ from 1 thread\n", n, detected, tracked);
+            ret = -1;
+        }
+    }
+    face_detector_get_eval_stats(det, &stats);
+    if (!ret)
+        printf("Threads 1..%d: identical, %d faces detected, %d tracked, %lu tracking windows merged\n",
+                max_threads, ref_detected, ref_tracked, stats.tracking_merged / max_threads);
+    face_detector_set_threads(det, 0);
+    return ret;
+}
+
+/* the full scan window by window must find what it did stage by stage */
+static int
+check_stage_major(struct face_det *det, unsigned char *y, const struct face *stage_major, int num_stage_major)
+{
+    struct face f[30];
+    int faces = 30;
+
+    if (face_detector_set_stage_major(det, 0))
+        return 0;
+    face_detector_detect(det, y, f, &faces);
+    face_detector_set_stage_major(det, 1);
+    if (!same_faces(stage_major, num_stage_major, f, faces)) {
+        printf("Depth first: %d faces, differ from the %d stage major\n", faces, num_stage_major);
+        return -1;
+    }
+    printf("Depth first and stage major: same %d faces\n", faces);
+    return 0;
+}
+
+/* without early exit every evaluator, stage major (the SIMD one with the float engine)
+ * then depth first, must find the faces found with it and skip no weak classifier */
+static int
+check_early_exit(struct face_det *det, unsigned char *y, const struct face *early, int num_early)
+{
+    static const char *order_names[] = { "depth first", "stage major" };
+    struct face_eval_stats before, after;
+    struct face f[30];
+    int faces, major, fixed_order, ret = 0;
+
+    if (face_detector_set_early_exit(det, 0))
+        return 0;
+    for (major = 1; major >= 0; major--) {
+        /* the drift and pyramid engines only go window by window */
+        fixed_order = face_detector_set_stage_major(det, major) != 0;
+        face_detector_get_eval_stats(det, &before);
+        faces = 30;
+        face_detector_detect(det, y, f, &faces);
+        face_detector_get_eval_stats(det, &after);
+        if (!same_faces(early, num_early, f, faces) || after.skipped != before.skipped) {
+            printf("Early exit: %s %d faces without it, %d with, %lu weak classifiers skipped\n",
+                    fixed_order ? "the engine's evaluator" : order_names[major], faces, num_early,
+                    after.skipped - before.skipped);
+            ret = -1;
+        }
+        if (fixed_order)
+            break;
+    }
+    face_detector_set_stage_major(det, 1);
+    face_detector_set_early_exit(det, 1);
+    if (!ret)
+        printf("Early exit: same %d faces without it, %s\n", num_early,
+                fixed_order ? "window by window" : "stage major and depth first");
+    return ret;
+}
+
+/* tracking the faces on the frame they were found in must keep every one of them */
+static int
+check_tracking(struct face_det *det, unsigned char *y, const struct face *detected, int num_detected)
+{
+    struct face f[30];
+    int faces = 30;
+
+    memcpy(f, detected, num_detected * sizeof(*f));
+    face_detector_tracking(det, y, f, num_detected, &faces);
+    if (faces != num_detected) {
+        printf("Tracking: %d faces on the same frame, the full scan found %d\n", faces, num_detected);
+        return -1;
+    }
+    printf("Tracking: same %d faces on the same frame\n", faces);
+    return 0;
+}
+
+/* tiled detection of the image cut into tiles of about 5/8 of it, and of the image
+ * as one tile clamped from a larger one, must group the faces a scan of the whole
+ * image does, with the same largest face */
+static int
+check_tiled(unsigned char *y, int width, int height)
+{
+    struct face_frame frame = { y, width, 0, 0, FACE_FORMAT_GRAY };
+    struct face ref[30], f[30], c[30];
+    int max_face = std::min(width, height) * 5 / 16;
+    int num_ref = 30, faces = 30, clamped = 30;
+    struct face_det *whole, *tiled, *large;
+    int ret = -1;
+
+    whole = face_detector_create_tiled(width, height, 24, max_face);
+    tiled = face_detector_create_tiled(width * 5 / 8, height * 5 / 8, 24, max_face);
+    large = face_detector_create_tiled(width + 37, height + 21, 24, max_face);
+    if (whole && tiled && large &&
+        !face_detector_detect_frame(whole, &frame, ref, &num_ref) &&
+        !face_detector_detect_tiled(tiled, &frame, width, height, f, &faces) &&
+        !face_detector_detect_tiled(large, &frame, width, height, c, &clamped)) {
+        if (same_faces(ref, num_ref, f, faces) && same_faces(ref, num_ref, c, clamped)) {
+            printf("Tiled: same %d faces in %dx%d tiles and in a tile clamped to the image\n",
+                    num_ref, width * 5 / 8, height * 5 / 8);
+            ret = 0;
+        } else {
+            printf("Tiled: %d faces in %dx%d tiles, %d in a clamped tile, %d in the whole image\n",
+                    faces, width * 5 / 8, height * 5 / 8, clamped, num_ref);
+        }
+    } else {
+        printf("Tiled: cannot detect in %dx%d tiles\n", width * 5 / 8, height * 5 / 8);
+    }
+    if (whole)
+        face_detector_destroy(whole);
+    if (tiled)
+        face_detector_destroy(tiled);
+    if (large)
+        face_detector_destroy(large);
+    return ret;
+}
+
+static double
+elapsed_ms(const struct timeval *start, const struct timeval *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_usec - start->tv_usec) / 1000.0;
+}
+
+/* processes the image as slices frames of a video, new faces must show up by the last */
+static int
+check_slices(struct face_det *det, unsigned char *y, int width, int slices, int detected)
+{
+    struct face_frame frame = { y, width, 0, 0, FACE_FORMAT_GRAY };
+    struct face f[30];
+    struct timeval start, end;
+    double ms, max_ms = 0;
+    int i, faces = 0;
+
+    if (face_detector_set_scan_slices(det, slices)) {
+        fprintf(stderr, "Cannot scan in slices: %d\n", slices);
+        return -1;
+    }
+    for (i = 0; i < slices; i++) {
+        int tracked = 30;
+        gettimeofday(&start, NULL);
+        face_detector_process_frame(det, &frame, f, faces, &tracked);
+        gettimeofday(&end, NULL);
+        faces = tracked;
+        ms = elapsed_ms(&start, &end);
+        if (ms > max_ms)
+            max_ms = ms;
+    }
+    printf("Slices %d: %d faces after %d frames (%d detected), at most %.1f ms per frame\n",
+            slices, faces, slices, detected, max_ms);
+    face_detector_set_scan_slices(det, 1);
+    return faces ? 0 : -(detected != 0);
+}
+
+/* windows face_detector_detect scans for y */
+static unsigned long
+detect_windows(struct face_det *det, unsigned char *y, struct face *f, int *faces)
+{
+    struct face_eval_stats before, after;
+
+    face_detector_get_eval_stats(det, &before);
+    *faces = 30;
+    face_detector_detect(det, y, f, faces);
+    face_detector_get_eval_stats(det, &after);
+    return after.windows - before.windows;
+}
+
+/* the gated scan of the same frame must find what the full scan did, and so must the
+ * one of a frame with a patch inverted, the windows away from it are sampled from pixels
+ * that did not change. Then the image pans a pixel a frame, too little for most blocks
+ * to change from one frame to the next, and after DRIFT_FRAMES frames the gated scan
+ * must again find what a full scan does */
+#define DRIFT_FRAMES 40
+
+static int
+check_motion(struct face_det *det, unsigned char *y, int width, int height, int block_size, int threshold,
+        const struct face *full, int num_full)
+{
+    struct face f[30], ref[30];
+    unsigned long same, patched, all, drift = 0;
+    int faces, num_ref, i, j, frame;
+    unsigned char *moved;
+
+    same = detect_windows(det, y, f, &faces);
+    if (!same_faces(full, num_full, f, faces)) {
+        printf("Motion gate: %d faces on the same frame, %d full scan\n", faces, num_full);
+        return -1;
+    }
+
+    moved = (unsigned char *)malloc(width * height);
+    memcpy(moved, y, width * height);
+    for (i = height / 2; i < height / 2 + height / 8; i++) {
+        for (j = width / 2; j < width / 2 + width / 8; j++)
+            moved[i * width + j] = 255 - moved[i * width + j];
+    }
+    patched = detect_windows(det, moved, f, &faces);
+    face_detector_set_motion_gate(det, 0, 0);
+    all = detect_windows(det, moved, ref, &num_ref);
+
+    if (!same_faces(ref, num_ref, f, faces)) {
+        printf("Motion gate: %d faces on a patched frame, %d full scan\n", faces, num_ref);
+        free(moved);
+        return -1;
+    }
+    printf("Motion gate %d:%d: %lu windows on the same frame, %lu on a patched one, of %lu, same faces as a full scan\n",
+            block_size, threshold, same, patched, all);
+
+    face_detector_set_motion_gate(det, block_size, threshold);
+    for (frame = 0; frame <= DRIFT_FRAMES; frame++) {
+        for (i = 0; i < height; i++) {
+            for (j = 0; j < width; j++)
+                moved[i * width + j] = y[i * width + (j > frame ? j - frame : 0)];
+        }
+        /* the first frame scans everything */
+        if (frame)
+            drift += detect_windows(det, moved, f, &faces);
+        else
+            detect_windows(det, moved, f, &faces);
+    }
+    face_detector_set_motion_gate(det, 0, 0);
+    detect_windows(det, moved, ref, &num_ref);
+    free(moved);
+
+    if (!same_faces(ref, num_ref, f, faces)) {
+        printf("Motion gate: %d faces after panning %d frames, %d full scan\n", faces, DRIFT_FRAMES, num_ref);
+        return -1;
+    }
+    printf("Motion gate %d:%d: %lu windows a frame panning a pixel a frame, same %d faces as a full scan after %d frames\n",
+            block_size, threshold, drift / DRIFT_FRAMES, faces, DRIFT_FRAMES);
+    return 0;
+}
+
+/* tracks the image moving dx pixels right a frame for 8 frames, without and with motion
+ * prediction, and prints the faces kept every frame and the windows searched. Prediction
+ * must keep as many faces as plain tracking every frame */
+static int
+check_prediction(struct face_det *det, unsigned char *y, int width, int height, int dx,
+        const struct face *detected, int num_detected)
+{
+    struct face_eval_stats before, after;
+    struct face f[30];
+    unsigned char *moved;
+    int plain[8], fewer = 0;
+    int predict, frame, faces, i, j;
+
+    moved = (unsigned char *)malloc(width * height);
+    for (predict = 0; predict < 2; predict++) {
+        face_detector_set_motion_prediction(det, predict);
+        memcpy(f, detected, num_detected * sizeof(struct face));
+        faces = num_detected;
+        face_detector_get_eval_stats(det, &before);
+        printf("Prediction %s, moving %d pixels a frame, faces:", predict ? "on" : "off", dx);
+        for (frame = 1; frame <= 8; frame++) {
+            int tracked = 30;
+            for (i = 0; i < height; i++) {
+                for (j = 0; j < width; j++)
+                    moved[i * width + j] = y[i * width + (j > dx * frame ? j - dx * frame : 0)];
+            }
+            face_detector_tracking(det, moved, f, faces, &tracked);
+            faces = tracked;
+            printf(" %d", faces);
+            if (!predict)
+                plain[frame - 1] = faces;
+            else if (faces < plain[frame - 1] && !fewer)
+                fewer = frame;
+        }
+        face_detector_get_eval_stats(det, &after);
+        printf(", %lu windows a frame\n", (after.windows - before.windows) / 8);
+    }
+    face_detector_set_motion_prediction(det, 0);
+    free(moved);
+    if (fewer) {
+        printf("Prediction: fewer faces than plain tracking in frame %d\n", fewer);
+        return -1;
+    }
+    return 0;
+}
 
 int
 main(int argc, char **argv)
 {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <width> <height> <image.y>\n", argv[0]);
+    const char *prog = argv[0];
+    int max_threads = 0, pool = 0, stop_faces = 0, stop_width = 0, slices = 0;
+    int motion_block = 0, motion_threshold = 2, velocity = -1;
+
+    for (;;) {
+        if (argc > 2 && !strcmp(argv[1], "-t")) {
+            max_threads = atoi(argv[2]);
+            argc -= 2;
+            argv += 2;
+        } else if (argc > 2 && !strcmp(argv[1], "-s")) {
+            const char *width = strchr(argv[2], ':');
+            stop_faces = atoi(argv[2]);
+            if (width)
+                stop_width = atoi(width + 1);
+            argc -= 2;
+            argv += 2;
+        } else if (argc > 2 && !strcmp(argv[1], "-a")) {
+            slices = atoi(argv[2]);
+            argc -= 2;
+            argv += 2;
+        } else if (argc > 2 && !strcmp(argv[1], "-m")) {
+            const char *threshold = strchr(argv[2], ':');
+            motion_block = atoi(argv[2]);
+            if (threshold)
+                motion_threshold = atoi(threshold + 1);
+            argc -= 2;
+            argv += 2;
+        } else if (argc > 2 && !strcmp(argv[1], "-v")) {
+            velocity = atoi(argv[2]);
+            argc -= 2;
+            argv += 2;
+        } else if (argc > 1 && !strcmp(argv[1], "-p")) {
+            pool = 1;
+            argc--;
+            argv++;
+        } else {
+            break;
+        }
+    }
+    if (argc < 4 || argc > 6 || max_threads < 0 || slices < 0) {
+        fprintf(stderr, "Usage: %s [-p] [-t max_threads] [-s faces[:min_width]] [-a slices] [-m block[:threshold]] [-v dx] <width> <height> <image.y> [float|fixed|drift|pyramid [coarse_step[:refine_stage]]]\n", prog);
         return 1;
     }
 
+    enum face_engine engine = FACE_ENGINE_FLOAT;
+    if (argc >= 5) {
+        unsigned int e;
+        for (e = 0; e < sizeof(engine_names) / sizeof(engine_names[0]); e++) {
+            if (!strcmp(argv[4], engine_names[e]))
+                break;
+        }
+        if (e == sizeof(engine_names) / sizeof(engine_names[0])) {
+            fprintf(stderr, "Unknown engine: %s\n", argv[4]);
+            return 1;
+        }
+        engine = (enum face_engine)e;
+    }
+
     int width, height;
     width = atoi(argv[1]);
     height = atoi(argv[2]);
@@ -41,12 +531,38 @@ main(int argc, char **argv)
         return 1;
     }
 
+    if (check_integral() || check_luma())
+        return 1;
+
     struct face_det *det;
-    det = face_detector_create(width, height, 24);
+    det = face_detector_create_engine(width, height, 24, engine);
     if (!det) {
         fprintf(stderr, "init face detector error\n");
         return 1;
     }
+    /* scan on the work stealing pool instead of OpenMP */
+    if (pool)
+        face_detector_set_thread_pool(det, 1);
+    /* largest faces first, stop once enough are found */
+    if ((stop_faces || stop_width) && face_detector_set_early_stop(det, stop_faces, stop_width)) {
+        fprintf(stderr, "Cannot stop early: %d:%d\n", stop_faces, stop_width);
+        return 1;
+    }
+    /* only windows over blocks that changed since the last frame */
+    if (motion_block && face_detector_set_motion_gate(det, motion_block, motion_threshold)) {
+        fprintf(stderr, "Cannot gate by motion: %d:%d\n", motion_block, motion_threshold);
+        return 1;
+    }
+    if (argc == 6) {
+        int coarse_step = atoi(argv[5]), refine_stage = 2;
+        const char *stage = strchr(argv[5], ':');
+        if (stage)
+            refine_stage = atoi(stage + 1);
+        if (face_detector_set_coarse_scan(det, coarse_step, refine_stage)) {
+            fprintf(stderr, "Cannot scan coarse to fine: %s\n", argv[5]);
+            return 1;
+        }
+    }
 
     unsigned char *y;
     ssize_t s;
@@ -68,8 +584,11 @@ main(int argc, char **argv)
     struct face f[30];
     int num_faces = 30;
     int i;
-    
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
     face_detector_detect(det, y, f, &num_faces);
+    gettimeofday(&end, NULL);
 
     for (i = 0 ;i < num_faces; i++) {
         printf("Face: %d %d %d %d\n", f[i].x, f[i].y, f[i].width, f[i].height);
@@ -81,6 +600,68 @@ main(int argc, char **argv)
     }
 #endif
     printf("Total: %d\n", num_faces);
+    printf("Time (%s): %.1f ms\n", engine_names[engine], elapsed_ms(&start, &end));
+
+    struct face_eval_stats stats;
+    face_detector_get_eval_stats(det, &stats);
+    printf("Windows: %lu\n", stats.windows);
+    printf("Weak classifiers: %lu evaluated, %lu skipped by %lu early rejects and %lu early accepts\n",
+            stats.evaluated, stats.skipped, stats.early_rejects, stats.early_accepts);
+
+    size_t cascade = face_detector_get_cascade_size(det);
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    printf("Cascade: %zu bytes with the geometry of a scale, L2 cache %ld bytes\n", cascade, sysconf(_SC_LEVEL2_CACHE_SIZE));
+#else
+    printf("Cascade: %zu bytes with the geometry of a scale\n", cascade);
+#endif
+
+    struct face_drift d;
+    if (face_detector_get_drift(det, &d) == 0) {
+        printf("Drift: %lu/%lu block sums differ (max %u), %lu/%lu lbp codes, %lu/%lu windows\n",
+                d.samples_differ, d.samples, d.max_error,
+                d.codes_differ, d.codes, d.windows_differ, d.windows);
+    }
+
+    if (!motion_block && check_stage_major(det, y, f, num_faces)) {
+        face_detector_destroy(det);
+        return 1;
+    }
+
+    if (!motion_block && check_early_exit(det, y, f, num_faces)) {
+        face_detector_destroy(det);
+        return 1;
+    }
+
+    if (max_threads && check_threads(det, y, max_threads)) {
+        face_detector_destroy(det);
+        return 1;
+    }
+
+    if (check_tracking(det, y, f, num_faces)) {
+        face_detector_destroy(det);
+        return 1;
+    }
+
+    /* tiled detectors always sample in float */
+    if (engine == FACE_ENGINE_FLOAT && check_tiled(y, width, height)) {
+        face_detector_destroy(det);
+        return 1;
+    }
+
+    if (velocity >= 0 && check_prediction(det, y, width, height, velocity, f, num_faces)) {
+        face_detector_destroy(det);
+        return 1;
+    }
+
+    if (motion_block && check_motion(det, y, width, height, motion_block, motion_threshold, f, num_faces)) {
+        face_detector_destroy(det);
+        return 1;
+    }
+
+    if (slices && check_slices(det, y, width, slices, num_faces)) {
+        face_detector_destroy(det);
+        return 1;
+    }
 
     face_detector_destroy(det);
 }
@@ -0,0 +1,74 @@
+/*
+ * facelbp - Face detection using Multi-scale Block Local Binary Pattern algorithm
+ *
+ * Copyright (C) 2013 Keith Mok <ek9852@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CPU_H
+#define _CPU_H
+
+#define CPU_FEATURE_SSE2    (1 << 0)
+#define CPU_FEATURE_SSSE3   (1 << 1)
+#define CPU_FEATURE_AVX2    (1 << 2)
+#define CPU_FEATURE_AVX512  (1 << 3) /* F + BW */
+
+#define cpuid(func,ax,bx,cx,dx)\
+	__asm__ __volatile__ ("cpuid":\
+	"=a" (ax), "=b" (bx), "=c" (cx), "=d" (dx) : "a" (func), "c" (0));
+
+/* leaf 1 %edx */
+#define bit_SSE2        (1 << 26)
+/* leaf 1 %ecx */
+#define bit_SSSE3       (1 << 9)
+#define bit_OSXSAVE     (1 << 27)
+#define bit_AVX         (1 << 28)
+/* leaf 7 %ebx */
+#define bit_AVX2        (1 << 5)
+#define bit_AVX512F     (1 << 16)
+#define bit_AVX512BW    (1 << 30)
+
+/* XCR0 state the OS must save for the wider registers to be usable */
+#define XSTATE_YMM      0x06
+#define XSTATE_ZMM      0xe6
+
+static inline unsigned int
+cpu_features(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int max_leaf, xcr0 = 0, flags = 0;
+
+    cpuid(0, max_leaf, ebx, ecx, edx);
+    cpuid(1, eax, ebx, ecx, edx);
+
+    if (edx & bit_SSE2)
+        flags |= CPU_FEATURE_SSE2;
+    if (ecx & bit_SSSE3)
+        flags |= CPU_FEATURE_SSSE3;
+
+    if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX))
+        __asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+
+    if (max_leaf >= 7) {
+        cpuid(7, eax, ebx, ecx, edx);
+        if ((ebx & bit_AVX2) && (xcr0 & XSTATE_YMM) == XSTATE_YMM)
+            flags |= CPU_FEATURE_AVX2;
+        if ((ebx & bit_AVX512F) && (ebx & bit_AVX512BW) && (xcr0 & XSTATE_ZMM) == XSTATE_ZMM)
+            flags |= CPU_FEATURE_AVX512;
+    }
+
+    return flags;
+}
+
+#endif
@@ -20,43 +20,303 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
 #include "face_detect.h"
 #include "lbp_detect.h"
 #include "integral_image.h"
 #include "common.h"
 
+/* 255 * pixels must fit in the 32 bits integral image */
+#define MAX_INTEGRAL_PIXELS (0xffffffffu / 255)
+
 struct face_det {
     struct lbp *l;
     int width;
     int height;
     unsigned int *integral_img;
+    unsigned char *luma; /* a row per thread building the integral image of colour frames */
+    int luma_rows;
+};
+
+struct integral_job {
+    struct face_det *f;
+    const struct face_frame *frame;
 };
 
+/* run by every thread of the scan team */
+static void
+gen_integral_image(void *priv, int x, int y, int width, int height)
+{
+    struct integral_job *job = (struct integral_job *)priv;
+    const struct face_frame *frame = job->frame;
+    struct face_det *f = job->f;
+
+    face_detector_gen_integral_image_team(f->integral_img, f->width,
+            frame->data + (long)(frame->y + y) * frame->stride + (frame->x + x) * face_format_pixel_bytes(frame->format),
+            frame->stride, frame->format, width, height, f->luma, f->luma_rows);
+}
+
+/* colour frames need a luma row per thread of the team, only grows when the team does */
+static int
+alloc_luma(struct face_det *f, const struct face_frame *frame)
+{
+    int rows = face_detector_lbp_team_threads(f->l);
+    unsigned char *luma;
+
+    if (!pf_luma_row[frame->format] || f->luma_rows >= rows)
+        return 0;
+    luma = (unsigned char *)realloc(f->luma, (size_t)rows * f->width);
+    if (!luma) {
+        ALOGE("Cannot allocate %d luma rows", rows);
+        return -ENOMEM;
+    }
+    f->luma = luma;
+    f->luma_rows = rows;
+    return 0;
+}
+
+/* every row of the width pixels read from (x, y) must end within the stride,
+ * -ENOMEM if the luma rows of a colour frame cannot be allocated */
+static int
+check_frame(struct face_det *f, const struct face_frame *frame, int width)
+{
+    if (frame->format < FACE_FORMAT_GRAY || frame->format >= FACE_FORMAT_MAX) {
+        ALOGE("Invalid frame format: %d", frame->format);
+        return -EINVAL;
+    }
+    if (!frame->data || frame->x < 0 || frame->y < 0 ||
+        (long)(frame->x + width) * face_format_pixel_bytes(frame->format) > frame->stride) {
+        ALOGE("Invalid frame stride: %d x: %d y: %d width: %d", frame->stride, frame->x, frame->y, width);
+        return -EINVAL;
+    }
+    return alloc_luma(f, frame);
+}
+
 int
-face_detector_detect(struct face_det *f, unsigned char *y, struct face *fa, int *maxfaces)
+face_detector_detect_frame(struct face_det *f, const struct face_frame *frame, struct face *fa, int *maxfaces)
+{
+    struct integral_job job = { f, frame };
+    int i, ret;
+
+    ret = check_frame(f, frame, f->width);
+    if (ret)
+        return ret;
+
+    face_detector_lbp_detect(f->l, f->integral_img, gen_integral_image, &job, fa, maxfaces);
+
+    for (i = 0; i < *maxfaces; i++) {
+        fa[i].x += frame->x;
+        fa[i].y += frame->y;
+    }
+    return 0;
+}
+
+int
+face_detector_tracking_frame(struct face_det *f, const struct face_frame *frame, struct face *fa, int faces, int *maxfaces)
 {
-    face_detector_gen_integral_image(f->integral_img, y, f->width, f->height);
-    face_detector_lbp_detect(f->l, f->integral_img, fa, maxfaces);
+    struct integral_job job = { f, frame };
+    int i, ret;
+
+    ret = check_frame(f, frame, f->width);
+    if (ret)
+        return ret;
+
+    for (i = 0; i < faces; i++) {
+        fa[i].x -= frame->x;
+        fa[i].y -= frame->y;
+    }
+
+    face_detector_lbp_tracking(f->l, f->integral_img, gen_integral_image, &job, fa, faces, maxfaces);
+
+    for (i = 0; i < *maxfaces; i++) {
+        fa[i].x += frame->x;
+        fa[i].y += frame->y;
+    }
+    return 0;
+}
+
+int
+face_detector_process_frame(struct face_det *f, const struct face_frame *frame, struct face *fa, int faces, int *maxfaces)
+{
+    struct integral_job job = { f, frame };
+    int i, ret;
+
+    ret = check_frame(f, frame, f->width);
+    if (ret)
+        return ret;
+
+    for (i = 0; i < faces; i++) {
+        fa[i].x -= frame->x;
+        fa[i].y -= frame->y;
+    }
+
+    face_detector_lbp_process(f->l, f->integral_img, gen_integral_image, &job, fa, faces, maxfaces);
 
+    for (i = 0; i < *maxfaces; i++) {
+        fa[i].x += frame->x;
+        fa[i].y += frame->y;
+    }
     return 0;
 }
 
+int
+face_detector_detect_stride(struct face_det *f, unsigned char *y, int stride, struct face *fa, int *maxfaces)
+{
+    struct face_frame frame = { y, stride, 0, 0, FACE_FORMAT_GRAY };
+
+    return face_detector_detect_frame(f, &frame, fa, maxfaces);
+}
+
+int
+face_detector_tracking_stride(struct face_det *f, unsigned char *y, int stride, struct face *fa, int faces, int *maxfaces)
+{
+    struct face_frame frame = { y, stride, 0, 0, FACE_FORMAT_GRAY };
+
+    return face_detector_tracking_frame(f, &frame, fa, faces, maxfaces);
+}
+
+int
+face_detector_detect(struct face_det *f, unsigned char *y, struct face *fa, int *maxfaces)
+{
+    return face_detector_detect_stride(f, y, f->width, fa, maxfaces);
+}
+
 int
 face_detector_tracking(struct face_det *f, unsigned char *y, struct face *fa, int faces, int *maxfaces)
 {
-    face_detector_gen_integral_image(f->integral_img, y, f->width, f->height);
-    face_detector_lbp_tracking(f->l, f->integral_img, fa, faces, maxfaces);
+    return face_detector_tracking_stride(f, y, f->width, fa, faces, maxfaces);
+}
+
+struct tile_job {
+    struct face_det *f;
+    const struct face_frame *frame;
+    int width; /* of the image from the tile origin, less than the tile if it is clamped */
+    int height;
+};
+
+/* run by every thread of the scan team. A tile clamped to a smaller image is integrated
+ * as if the pixels past the image were 0, the integral values repeat the last column and
+ * row, and add_tile_hits drops the windows that read them */
+static void
+gen_tile_integral_image(void *priv, int x, int y, int width, int height)
+{
+    struct tile_job *job = (struct tile_job *)priv;
+    struct face_det *f = job->f;
+    struct integral_job image = { f, job->frame };
+    int w = std::min(width, job->width), h = std::min(height, job->height);
+    int i, j;
+
+    gen_integral_image(&image, x, y, w, h);
+    if (w == width && h == height)
+        return;
+
+    /* the last row of the image must be complete before it is repeated */
+    #pragma omp barrier
+    #pragma omp for
+    for (i = 0; i < height; i++) {
+        unsigned int *row = f->integral_img + (long)i * f->width;
+        if (i >= h)
+            memcpy(row, f->integral_img + (long)(h - 1) * f->width, w * sizeof(unsigned int));
+        for (j = w; j < width; j++)
+            row[j] = row[w - 1];
+    }
+}
+
+/* hits of a tile are kept only inside its core, so every window is counted by one tile,
+ * and only if the window fits in the image the way a scan of the whole image fits it */
+static void
+add_tile_hits(std::vector<struct lbp_rect>& all, std::vector<struct lbp_rect>& hits,
+        int origin_x, int origin_y, int core_x0, int core_y0, int core_x1, int core_y1,
+        int width, int height)
+{
+    unsigned int i;
+    for (i = 0; i < hits.size(); i++) {
+        struct lbp_rect r = hits[i];
+        r.x += origin_x;
+        r.y += origin_y;
+        if (r.x >= core_x0 && r.x < core_x1 && r.y >= core_y0 && r.y < core_y1 &&
+            r.x + r.w < width - 1 && r.y + r.h < height - 1)
+            all.push_back(r);
+    }
+    hits.clear();
+}
+
+/* task order of a scan of the whole image, by scale then column by column */
+static bool
+tile_hit_less(const struct lbp_rect& a, const struct lbp_rect& b)
+{
+    if (a.w != b.w)
+        return a.w < b.w;
+    return a.x < b.x || (a.x == b.x && a.y < b.y);
+}
+
+int
+face_detector_detect_tiled(struct face_det *f, const struct face_frame *frame, int width, int height, struct face *fa, int *maxfaces)
+{
+    std::vector<struct lbp_rect> all, hits;
+    int overlap_x, overlap_y, step_x, step_y;
+    int core_x0, core_y0, core_x1, core_y1;
+    int i, ret;
+
+    ret = check_frame(f, frame, width);
+    if (ret)
+        return ret;
+
+    /* tiles overlap by the largest window so no window is cut at a seam */
+    face_detector_lbp_max_window(f->l, &overlap_x, &overlap_y);
+    step_x = f->width - overlap_x;
+    step_y = f->height - overlap_y;
+    if (step_x <= 0 || step_y <= 0) {
+        ALOGE("Tile %dx%d does not fit window %dx%d", f->width, f->height, overlap_x, overlap_y);
+        return -EINVAL;
+    }
 
+    /* an image smaller than the tile is one tile clamped to it */
+    for (core_y0 = 0; core_y0 < height; core_y0 = core_y1) {
+        int last_y = core_y0 + f->height >= height;
+        int origin_y = last_y ? std::max(height - f->height, 0) : core_y0;
+        core_y1 = last_y ? height : core_y0 + step_y;
+
+        for (core_x0 = 0; core_x0 < width; core_x0 = core_x1) {
+            int last_x = core_x0 + f->width >= width;
+            int origin_x = last_x ? std::max(width - f->width, 0) : core_x0;
+            struct face_frame tile = *frame;
+            struct tile_job job = { f, &tile, width - origin_x, height - origin_y };
+            core_x1 = last_x ? width : core_x0 + step_x;
+
+            tile.x += origin_x;
+            tile.y += origin_y;
+            face_detector_lbp_detect_tile(f->l, f->integral_img, gen_tile_integral_image, &job,
+                    origin_x, origin_y, hits);
+            add_tile_hits(all, hits, origin_x, origin_y, core_x0, core_y0, core_x1, core_y1, width, height);
+        }
+    }
+
+    /* so the faces are grouped in the order a scan of the whole image has */
+    std::sort(all.begin(), all.end(), tile_hit_less);
+    face_detector_lbp_group(f->l, all, fa, maxfaces);
+
+    for (i = 0; i < *maxfaces; i++) {
+        fa[i].x += frame->x;
+        fa[i].y += frame->y;
+    }
     return 0;
 }
 
-struct face_det *
-face_detector_create(int width, int height, int minimum_face_width)
+static struct face_det *
+create_detector(int width, int height, int minimum_face_width, int maximum_face_width, enum face_engine engine)
 {
     struct face_det *f;
+
+    if ((unsigned long)width * height > MAX_INTEGRAL_PIXELS) {
+        ALOGW("%dx%d overflows the integral image, use face_detector_create_tiled", width, height);
+    }
+
     f = (struct face_det *)calloc(1, sizeof(struct face_det));
 
-    f->l = face_detector_lbp_create(width, height, minimum_face_width);
+    f->l = face_detector_lbp_create(width, height, minimum_face_width, maximum_face_width, engine);
 
     if (!f->l) {
         free(f);
@@ -69,11 +329,122 @@ face_detector_create(int width, int height, int minimum_face_width)
     return f;
 }
 
+struct face_det *
+face_detector_create(int width, int height, int minimum_face_width)
+{
+    return create_detector(width, height, minimum_face_width, 0, FACE_ENGINE_FLOAT);
+}
+
+struct face_det *
+face_detector_create_engine(int width, int height, int minimum_face_width, enum face_engine engine)
+{
+    return create_detector(width, height, minimum_face_width, 0, engine);
+}
+
+struct face_det *
+face_detector_create_tiled(int tile_width, int tile_height, int minimum_face_width, int maximum_face_width)
+{
+    if (maximum_face_width <= 0 || maximum_face_width >= tile_width || maximum_face_width >= tile_height) {
+        ALOGE("Maximum face width %d must be smaller than the tile %dx%d", maximum_face_width, tile_width, tile_height);
+        return NULL;
+    }
+    if ((unsigned long)tile_width * tile_height > MAX_INTEGRAL_PIXELS) {
+        ALOGE("Tile %dx%d too large", tile_width, tile_height);
+        return NULL;
+    }
+    return create_detector(tile_width, tile_height, minimum_face_width, maximum_face_width, FACE_ENGINE_FLOAT);
+}
+
+int
+face_detector_set_threads(struct face_det *f, int threads)
+{
+    return face_detector_lbp_threads(f->l, threads);
+}
+
+int
+face_detector_set_thread_pool(struct face_det *f, int enable)
+{
+    return face_detector_lbp_thread_pool(f->l, enable);
+}
+
+int
+face_detector_set_affinity(struct face_det *f, const int *cpus, int num_cpus)
+{
+    return face_detector_lbp_affinity(f->l, cpus, num_cpus);
+}
+
+int
+face_detector_set_block_scan(struct face_det *f, size_t block_bytes)
+{
+    return face_detector_lbp_block_scan(f->l, block_bytes == FACE_BLOCK_L2 ? LBP_BLOCK_L2 : block_bytes);
+}
+
+int
+face_detector_set_early_stop(struct face_det *f, int faces, int min_width)
+{
+    return face_detector_lbp_early_stop(f->l, faces, min_width);
+}
+
+int
+face_detector_set_stage_major(struct face_det *f, int enable)
+{
+    return face_detector_lbp_stage_major(f->l, enable);
+}
+
+int
+face_detector_set_early_exit(struct face_det *f, int enable)
+{
+    return face_detector_lbp_early_exit(f->l, enable);
+}
+
+int
+face_detector_set_motion_prediction(struct face_det *f, int enable)
+{
+    return face_detector_lbp_motion_prediction(f->l, enable);
+}
+
+int
+face_detector_set_scan_slices(struct face_det *f, int slices)
+{
+    return face_detector_lbp_scan_slices(f->l, slices);
+}
+
+int
+face_detector_set_motion_gate(struct face_det *f, int block_size, int threshold)
+{
+    return face_detector_lbp_motion_gate(f->l, block_size, threshold);
+}
+
+int
+face_detector_set_coarse_scan(struct face_det *f, int coarse_step, int refine_stage)
+{
+    return face_detector_lbp_coarse_scan(f->l, coarse_step, refine_stage);
+}
+
+void
+face_detector_get_eval_stats(struct face_det *f, struct face_eval_stats *stats)
+{
+    face_detector_lbp_eval_stats(f->l, stats);
+}
+
+size_t
+face_detector_get_cascade_size(struct face_det *f)
+{
+    return face_detector_lbp_cascade_size(f->l);
+}
+
+int
+face_detector_get_drift(struct face_det *f, struct face_drift *d)
+{
+    return face_detector_lbp_drift(f->l, d);
+}
+
 void
 face_detector_destroy(struct face_det *f)
 {
     if (f->l)
         face_detector_lbp_destroy(f->l);
     free(f->integral_img);
+    free(f->luma);
     free(f);
 }
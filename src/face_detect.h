@@ -19,13 +19,117 @@
 #ifndef _FACE_DETECT_H
 #define _FACE_DETECT_H
 
+#include <stddef.h>
 #include "face_object.h"
 
 struct face_det;
 
+/* A frame inside a possibly larger buffer, read in place.
+ * The area scanned starts at (x, y) and has the size given to face_detector_create,
+ * faces passed in and out are in buffer coordinates. Rows read from x must end within
+ * the stride, -EINVAL otherwise.
+ * -ENOMEM if the rows colour formats are converted into cannot be allocated.
+ * Colour formats are turned into luma while the integral image is built. */
+struct face_frame {
+    unsigned char *data;
+    int stride; /* bytes between rows */
+    int x;
+    int y;
+    enum face_format format;
+};
+
 int face_detector_detect(struct face_det *f, unsigned char *y, struct face *fa, int *maxfaces);
 int face_detector_tracking(struct face_det *f, unsigned char *y, struct face *fa, int faces, int *maxfaces);
+int face_detector_detect_stride(struct face_det *f, unsigned char *y, int stride, struct face *fa, int *maxfaces);
+int face_detector_tracking_stride(struct face_det *f, unsigned char *y, int stride, struct face *fa, int faces, int *maxfaces);
+int face_detector_detect_frame(struct face_det *f, const struct face_frame *frame, struct face *fa, int *maxfaces);
+int face_detector_tracking_frame(struct face_det *f, const struct face_frame *frame, struct face *fa, int faces, int *maxfaces);
+/* One call per video frame instead of switching between tracking and full scans.
+ * Tracks the faces of the previous frame passed in fa and scans the next of the slices
+ * set by face_detector_set_scan_slices, so new faces are found within that many frames
+ * and every frame costs about the same. */
+int face_detector_process_frame(struct face_det *f, const struct face_frame *frame, struct face *fa, int faces, int *maxfaces);
 struct face_det *face_detector_create(int width, int height, int minimum_face_width);
+/* face_detector_create with another sampling engine, FACE_ENGINE_FLOAT is the default.
+ * The OpenCL build always samples in float. */
+struct face_det *face_detector_create_engine(int width, int height, int minimum_face_width, enum face_engine engine);
+/* Threads scanning, 0 (the default) for the OpenMP default. The faces found do not
+ * depend on it. -EINVAL for a negative count, -ENOMEM if the pyramid engine cannot
+ * allocate the rows of more threads. */
+int face_detector_set_threads(struct face_det *f, int threads);
+/* Scan on a pool of persistent threads that steal tiles of windows from each other
+ * instead of OpenMP, the default when built without OpenMP. The pyramid engine always
+ * scans with OpenMP. */
+int face_detector_set_thread_pool(struct face_det *f, int enable);
+/* Pins pool thread i (the caller is thread 0 and is left alone) to cpus[(i - 1) % num_cpus],
+ * NULL unpins them. -ENOSYS where threads cannot be pinned. */
+int face_detector_set_affinity(struct face_det *f, const int *cpus, int num_cpus);
+/* Dense full scans go through the windows of each scale in blocks whose integral image
+ * footprint is about block_bytes, instead of column by column down the whole frame, so
+ * the rows a block reads stay in the cache. FACE_BLOCK_L2 sizes them for half the L2
+ * cache, 0 (the default) scans column by column. The faces found are the same.
+ * Not for the pyramid engine and OpenCL, -EINVAL. */
+#define FACE_BLOCK_L2 ((size_t)-1)
+int face_detector_set_block_scan(struct face_det *f, size_t block_bytes);
+/* face_detector_detect scans from the largest faces down and returns the faces found so
+ * far once there are faces of them or one is at least min_width wide, for autofocus or
+ * auto exposure that only want the largest face or to know there is one. Either may be
+ * 0, both 0 (the default) scan every size. The scan is dense, column by column, and
+ * smaller faces than the ones returned are not looked for. -EINVAL if negative. */
+int face_detector_set_early_stop(struct face_det *f, int faces, int min_width);
+/* Windows go through the cascade stage by stage a tile at a time (the default), so
+ * the stage being evaluated stays in the cache, or 0 window by window through every
+ * stage. The faces found are the same. Not for the drift and pyramid engines and
+ * OpenCL, -EINVAL. */
+int face_detector_set_stage_major(struct face_det *f, int enable);
+/* A stage stops summing its weak classifiers once the partial sum can no longer reach,
+ * or fall below, its threshold (the default), 0 sums all of them. The faces found are
+ * the same. Not for OpenCL, -EINVAL. */
+int face_detector_set_early_exit(struct face_det *f, int enable);
+/* Tracking keeps the velocity of every face and searches around where it will be next
+ * instead of where it was. Each time a face turns up close to its prediction the search
+ * box and scale range get narrower, down to 25% of the face width around it and 0.7x-1.5x,
+ * and they are back to the full 50% and 0.5x-1.5x as soon as it does not. A face lost
+ * by one call is searched for again by the next, in the full box where it would be by
+ * then. Faces that jump further may be lost until the next full scan. Off by default. */
+int face_detector_set_motion_prediction(struct face_det *f, int enable);
+/* Cuts the full scan of face_detector_process_frame into slices of about the same
+ * number of windows, scanned densely one per frame. 1 (the default) scans the whole
+ * frame every time and does not track. -EINVAL if less than 1. */
+int face_detector_set_scan_slices(struct face_det *f, int slices);
+/* For fixed cameras. face_detector_detect keeps the sums of block_size pixels square
+ * blocks and only scans the windows over blocks whose mean changed by more than threshold
+ * grey levels since the block last changed, the other windows keep what they found then,
+ * so slow changes add up until they are scanned. The first frame and the one after this
+ * call scan everything. Every engine samples a window from its own pixels only, so a
+ * window whose pixels did not change finds what a full scan does, but changes that leave
+ * the sums of all their blocks within threshold are missed: the faces found can differ
+ * from a full scan until the blocks change enough. The scan is dense, column by column.
+ * block_size 0 (the default) scans every window.
+ * Not for the pyramid engine and OpenCL, -EINVAL. */
+int face_detector_set_motion_gate(struct face_det *f, int block_size, int threshold);
+/* Full scans try every coarse_step-th window along x and y first, the windows within
+ * coarse_step - 1 grid steps of one that passes refine_stage stages are then scanned
+ * through the whole cascade. Faces only a few windows wide may be missed, larger steps
+ * and fewer stages scan fewer windows. coarse_step 1 (the default) scans every window.
+ * Not for the drift and pyramid engines, -EINVAL. */
+int face_detector_set_coarse_scan(struct face_det *f, int coarse_step, int refine_stage);
+/* weak classifiers evaluated and skipped by the early exit of the stages since create */
+void face_detector_get_eval_stats(struct face_det *f, struct face_eval_stats *stats);
+/* bytes of the packed cascade and of the sampling geometry of one scale, what a scan
+ * reads for every window, to check it fits in the L2 cache */
+size_t face_detector_get_cascade_size(struct face_det *f);
+/* drift accumulated since create, -EINVAL unless created with FACE_ENGINE_FIXED_DRIFT */
+int face_detector_get_drift(struct face_det *f, struct face_drift *d);
+
+/* Tiled detection for images too large for one integral image (more than 16.8M pixels
+ * overflow it). The detector is created for the tile size, tiles overlap by the largest
+ * window so faces must be smaller than the tile, memory only depends on the tile size.
+ * Tiles scan the windows of the whole image, so the faces are the ones a detector of the
+ * image size with the same maximum face finds. An image smaller than the tile is scanned
+ * as one tile clamped to it. */
+struct face_det *face_detector_create_tiled(int tile_width, int tile_height, int minimum_face_width, int maximum_face_width);
+int face_detector_detect_tiled(struct face_det *f, const struct face_frame *frame, int width, int height, struct face *fa, int *maxfaces);
 void face_detector_destroy(struct face_det *f);
 
 #endif
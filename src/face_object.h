@@ -27,4 +27,47 @@ struct face {
     int confidence_level; /* 0 - 100 */
 };
 
+/* layout of the frame data, only the luma is used */
+enum face_format {
+    FACE_FORMAT_GRAY = 0,
+    FACE_FORMAT_NV12,   /* data/stride of the Y plane */
+    FACE_FORMAT_I420,   /* data/stride of the Y plane */
+    FACE_FORMAT_YUYV,
+    FACE_FORMAT_UYVY,
+    FACE_FORMAT_RGB,
+    FACE_FORMAT_BGR,
+    FACE_FORMAT_RGBA,   /* also RGBx */
+    FACE_FORMAT_BGRA,   /* also BGRx */
+    FACE_FORMAT_MAX
+};
+
+/* how the detector samples the integral image */
+enum face_engine {
+    FACE_ENGINE_FLOAT = 0,      /* scaled detector, double precision bilinear sampling */
+    FACE_ENGINE_FIXED,          /* scaled detector, 16 bit fixed point bilinear sampling */
+    FACE_ENGINE_FIXED_DRIFT,    /* float results, measures how far the fixed point drifts */
+    FACE_ENGINE_PYRAMID,        /* downscaled frames scanned at scale 1, no interpolation */
+};
+
+/* accumulated by FACE_ENGINE_FIXED_DRIFT, fixed point compared with float */
+struct face_drift {
+    unsigned long samples;          /* interpolated block sums */
+    unsigned long samples_differ;
+    unsigned int max_error;         /* largest difference of a block sum */
+    unsigned long codes;            /* weak classifiers evaluated */
+    unsigned long codes_differ;     /* ... that got another lbp code */
+    unsigned long windows;
+    unsigned long windows_differ;   /* windows with another accept/reject */
+};
+
+/* weak classifier work accumulated since create, stages stop once their outcome is certain */
+struct face_eval_stats {
+    unsigned long windows;          /* windows that went into the cascade */
+    unsigned long evaluated;        /* weak classifiers evaluated */
+    unsigned long skipped;          /* left out of stages that stopped early */
+    unsigned long early_rejects;    /* stages that stopped as they could no longer pass */
+    unsigned long early_accepts;    /* ... as they could no longer fail */
+    unsigned long tracking_merged;  /* tracking windows in the search regions of two faces, scanned once */
+};
+
 #endif
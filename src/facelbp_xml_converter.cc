@@ -25,6 +25,7 @@
 #include <string.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
+#include "lbp.h"
 
 static xmlNode*
 find_node(xmlNode *node, const char *name)
@@ -39,7 +40,7 @@ find_node(xmlNode *node, const char *name)
 }
 
 static int
-write_phrase(char *line, std::ofstream &of, int start, int end)
+write_phrase(char *line, std::ostream &of, int start, int end)
 {
      char *phrase, *brk;
      const char sep[] = "\n\t ";
@@ -63,7 +64,7 @@ write_phrase(char *line, std::ofstream &of, int start, int end)
 }
 
 static void
-process_elements(xmlDoc *doc, xmlNode *root_node, std::ofstream &of)
+process_elements(xmlDoc *doc, xmlNode *root_node, std::ostream &of)
 {
     xmlNode *cascade_node, *node, *stages_node, *underscore_node;
     xmlNode *weak_classifiers, *underscore_node_2;
@@ -236,17 +237,106 @@ process_elements(xmlDoc *doc, xmlNode *root_node, std::ofstream &of)
     
 }
 
+/* Reads back the facelbp format and writes it as a C++ header for configure
+ * --with-builtin-cascade, the counts become constants the evaluator unrolls on. */
+static int
+write_header(std::istream &in, std::ostream &of)
+{
+    struct weak_classifier c;
+    struct lbp_rect r;
+    float stage_threshold;
+    int feature_width, feature_height, num_stages, num_weak_classifiers, num_rects, first = 0;
+    int i, j, k;
+    char buf[32];
+
+    in >> feature_height >> feature_width >> num_stages;
+    if (in.fail() || num_stages <= 0)
+        return -1;
+
+    of << "/* generated by facelbp_xml_converter -H, do not edit */\n\n";
+    of << "#define LBP_BUILTIN_FEATURE_WIDTH " << feature_width << "\n";
+    of << "#define LBP_BUILTIN_FEATURE_HEIGHT " << feature_height << "\n";
+    of << "#define LBP_BUILTIN_NUM_STAGES " << num_stages << "\n\n";
+    of << "template <int S> struct lbp_builtin_stage;\n\n";
+
+    std::stringstream table;
+    for (i = 0; i < num_stages; i++) {
+        in >> num_weak_classifiers >> stage_threshold;
+        if (in.fail() || num_weak_classifiers <= 0)
+            return -1;
+
+        of << "static const struct weak_classifier lbp_builtin_classifiers_" << i << "[] = {\n";
+        for (j = 0; j < num_weak_classifiers; j++) {
+            in >> c.rect_idx;
+            for (k = 0; k < 8; k++)
+                in >> c.lbpmap[k];
+            in >> c.neg >> c.pos;
+            if (in.fail())
+                return -1;
+            of << "    {" << c.rect_idx << ", {";
+            for (k = 0; k < 8; k++)
+                of << c.lbpmap[k] << (k < 7 ? ", " : "}, ");
+            snprintf(buf, sizeof(buf), "%.9ef", c.pos);
+            of << buf << ", ";
+            snprintf(buf, sizeof(buf), "%.9ef", c.neg);
+            of << buf << "},\n";
+        }
+        of << "};\n\n";
+
+        snprintf(buf, sizeof(buf), "%.9ef", stage_threshold);
+        of << "template <> struct lbp_builtin_stage<" << i << "> {\n";
+        /* first indexes the geometry tables, which are in classifier order */
+        of << "    enum { num_weak_classifiers = " << num_weak_classifiers << ", first = " << first << " };\n";
+        of << "    static float threshold() { return " << buf << "; }\n";
+        of << "    static const struct weak_classifier *classifiers() { return lbp_builtin_classifiers_" << i << "; }\n";
+        of << "};\n\n";
+
+        first += num_weak_classifiers;
+        table << "    {" << buf << ", " << num_weak_classifiers << ", lbp_builtin_classifiers_" << i << "},\n";
+    }
+
+    /* same layout as struct stage, for filling lbp_data */
+    of << "struct lbp_builtin_stage_data {\n";
+    of << "    float stage_threshold;\n";
+    of << "    int num_weak_classifiers;\n";
+    of << "    const struct weak_classifier *classifiers;\n";
+    of << "};\n\n";
+    of << "static const struct lbp_builtin_stage_data lbp_builtin_stages[] = {\n" << table.str() << "};\n\n";
+
+    in >> num_rects;
+    if (in.fail() || num_rects <= 0)
+        return -1;
+    of << "#define LBP_BUILTIN_NUM_RECTS " << num_rects << "\n\n";
+    of << "static const struct lbp_rect lbp_builtin_rects[] = {\n";
+    for (i = 0; i < num_rects; i++) {
+        in >> r.x >> r.y >> r.w >> r.h;
+        if (in.fail())
+            return -1;
+        of << "    {" << r.x << ", " << r.y << ", " << r.w << ", " << r.h << "},\n";
+    }
+    of << "};\n";
+
+    return 0;
+}
+
 int
 main(int argc, char **argv)
 {
     xmlDoc *doc = NULL;
     xmlNode *root_element = NULL;
     int ret = 0;
+    int header = 0;
 
     printf("Program to convert opencv lbp xml format to facelbp format\n");
 
+    if (argc == 4 && !strcmp(argv[1], "-H")) {
+        header = 1;
+        argc--;
+        argv++;
+    }
     if (argc != 3) {
-        fprintf(stderr, "Usage: %s <input.xml> <output.txt>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-H] <input.xml> <output>\n", argv[0]);
+        fprintf(stderr, "  -H  write a C++ header for configure --with-builtin-cascade\n");
         return 1;
     }
 
@@ -258,6 +348,7 @@ main(int argc, char **argv)
     }
 
     std::ofstream of;
+    std::stringstream ss;
     of.open(argv[2]);
     if (of.fail()) {
         fprintf(stderr, "error: could not create output file %s\n", argv[2]);
@@ -273,7 +364,15 @@ main(int argc, char **argv)
         goto out;
     }
 
-    process_elements(doc, root_element, of);
+    if (header) {
+        process_elements(doc, root_element, ss);
+        if (write_header(ss, of)) {
+            fprintf(stderr, "error: incomplete cascade in %s\n", argv[1]);
+            ret = 1;
+        }
+    } else {
+        process_elements(doc, root_element, of);
+    }
 
     of.close();
 
@@ -16,9 +16,17 @@
  * limitations under the License.
  */
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <stdlib.h>
 #include "integral_image.h"
 #include "common.h"
 
+/* do not bother splitting small frames */
+#define INTEGRAL_MIN_BLOCK_ROWS 64
+#define INTEGRAL_MIN_MT_PIXELS  (640 * 480)
+
 #if 0
 static double
 get_realtime() {
@@ -28,8 +36,201 @@ get_realtime() {
 }
 #endif
 
+/* default handler */
+static void integral_row(unsigned int *dst, const unsigned int *prev, const unsigned char *src, int width);
+integral_row_t pf_integral_row = integral_row;
+struct integral_row_kernel integral_row_kernels[INTEGRAL_MAX_ROW_KERNELS] = { { "c", integral_row } };
+int num_integral_row_kernels = 1;
+
+static void
+integral_row(unsigned int *dst, const unsigned int *prev, const unsigned char *src, int width)
+{
+    int j;
+    unsigned int rs = 0;
+
+    if (!prev) {
+        for (j = 0; j < width; j++) {
+            rs += src[j];
+            dst[j] = rs;
+        }
+        return;
+    }
+    for (j = 0; j < width; j++) {
+        rs += src[j];
+        dst[j] = rs + prev[j];
+    }
+}
+
+/* same fixed point weights as OpenCV uses for RGB2GRAY */
+#define R2Y 4899
+#define G2Y 9617
+#define B2Y 1868
+#define Y_SHIFT 14
+
+static void
+luma_row_yuyv(unsigned char *dst, const unsigned char *src, int width)
+{
+    int j;
+    for (j = 0; j < width; j++) {
+        dst[j] = src[j * 2];
+    }
+}
+
+static void
+luma_row_uyvy(unsigned char *dst, const unsigned char *src, int width)
+{
+    int j;
+    for (j = 0; j < width; j++) {
+        dst[j] = src[j * 2 + 1];
+    }
+}
+
+#define LUMA_ROW_RGB(name, bytes, r, g, b) \
+static void \
+name(unsigned char *dst, const unsigned char *src, int width) \
+{ \
+    int j; \
+    for (j = 0; j < width; j++, src += bytes) { \
+        dst[j] = (src[r] * R2Y + src[g] * G2Y + src[b] * B2Y + (1 << (Y_SHIFT - 1))) >> Y_SHIFT; \
+    } \
+}
+
+LUMA_ROW_RGB(luma_row_rgb, 3, 0, 1, 2)
+LUMA_ROW_RGB(luma_row_bgr, 3, 2, 1, 0)
+LUMA_ROW_RGB(luma_row_rgba, 4, 0, 1, 2)
+LUMA_ROW_RGB(luma_row_bgra, 4, 2, 1, 0)
+
+/* in enum face_format order */
+luma_row_t pf_luma_row[FACE_FORMAT_MAX] = {
+    NULL,           /* GRAY */
+    NULL,           /* NV12 */
+    NULL,           /* I420 */
+    luma_row_yuyv,
+    luma_row_uyvy,
+    luma_row_rgb,
+    luma_row_bgr,
+    luma_row_rgba,
+    luma_row_bgra,
+};
+
+struct luma_row_kernel luma_row_kernels[LUMA_MAX_ROW_KERNELS] = {
+    { "c", FACE_FORMAT_YUYV, luma_row_yuyv },
+    { "c", FACE_FORMAT_UYVY, luma_row_uyvy },
+    { "c", FACE_FORMAT_RGB, luma_row_rgb },
+    { "c", FACE_FORMAT_BGR, luma_row_bgr },
+    { "c", FACE_FORMAT_RGBA, luma_row_rgba },
+    { "c", FACE_FORMAT_BGRA, luma_row_bgra },
+};
+int num_luma_row_kernels = 6;
+
+int
+face_format_pixel_bytes(enum face_format format)
+{
+    switch (format) {
+    case FACE_FORMAT_YUYV:
+    case FACE_FORMAT_UYVY:
+        return 2;
+    case FACE_FORMAT_RGB:
+    case FACE_FORMAT_BGR:
+        return 3;
+    case FACE_FORMAT_RGBA:
+    case FACE_FORMAT_BGRA:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+static inline void
+integral_add_row(unsigned int *dst, const unsigned int *carry, int width)
+{
+    int j;
+    for (j = 0; j < width; j++) {
+        dst[j] += carry[j];
+    }
+}
+
+void
+face_detector_gen_integral_image_team(unsigned int *i_data, int i_stride, const unsigned char *data, int stride,
+        enum face_format format, int width, int height, unsigned char *luma, int luma_rows)
+{
+    luma_row_t luma_row = pf_luma_row[format];
+    int blocks = 1;
+    int b, i;
+
+    if (width <= 0 || height <= 0)
+        return;
+
+#ifdef _OPENMP
+    blocks = omp_get_num_threads();
+#endif
+    if (blocks > height / INTEGRAL_MIN_BLOCK_ROWS)
+        blocks = height / INTEGRAL_MIN_BLOCK_ROWS;
+    if (luma_row && blocks > luma_rows)
+        blocks = luma_rows;
+    if (blocks < 1)
+        blocks = 1;
+
+#define BLOCK_FIRST_ROW(b) ((int)((long)height * (b) / blocks))
+
+    /* pass 1: integrate every row block as if it starts at the top of the frame */
+    #pragma omp for schedule(static)
+    for (b = 0; b < blocks; b++) {
+        int first = BLOCK_FIRST_ROW(b);
+        int end = BLOCK_FIRST_ROW(b + 1);
+        int row;
+        /* colour rows are turned into luma in a row of the block that stays in L1 */
+        unsigned char *block_luma = luma + (long)b * width;
+
+        for (row = first; row < end; row++) {
+            const unsigned char *src = data + (long)row * stride;
+            if (luma_row) {
+                luma_row(block_luma, src, width);
+                src = block_luma;
+            }
+            pf_integral_row(i_data + row * i_stride, row == first ? NULL : i_data + (row - 1) * i_stride, src, width);
+        }
+    }
+
+    if (blocks == 1)
+        return;
+
+    /* pass 2: only the last row of each block carries into the next one, propagate it serially */
+    #pragma omp single
+    for (b = 1; b < blocks; b++) {
+        integral_add_row(i_data + (BLOCK_FIRST_ROW(b + 1) - 1) * i_stride,
+                i_data + (BLOCK_FIRST_ROW(b) - 1) * i_stride, width);
+    }
+
+    /* pass 3: add the carry of the block above to the remaining rows */
+    #pragma omp for schedule(static)
+    for (i = BLOCK_FIRST_ROW(1); i < height; i++) {
+        int block = (int)((long)i * blocks / height);
+        int first, end;
+
+        /* fix the estimate up for rounding */
+        while (BLOCK_FIRST_ROW(block) > i)
+            block--;
+        while (BLOCK_FIRST_ROW(block + 1) <= i)
+            block++;
+        first = BLOCK_FIRST_ROW(block);
+        end = BLOCK_FIRST_ROW(block + 1);
+        if (i == end - 1)
+            continue; /* already done in pass 2 */
+        integral_add_row(i_data + i * i_stride, i_data + (first - 1) * i_stride, width);
+    }
+#undef BLOCK_FIRST_ROW
+}
+
 void
 face_detector_gen_integral_image(unsigned int *i_data, unsigned char *data, int width, int height)
+{
+    #pragma omp parallel if (width * height >= INTEGRAL_MIN_MT_PIXELS)
+    face_detector_gen_integral_image_team(i_data, width, data, width, FACE_FORMAT_GRAY, width, height, NULL, 0);
+}
+
+void
+face_detector_gen_integral_image_ref(unsigned int *i_data, unsigned char *data, int width, int height)
 {
     // first row only
     int i, j;
@@ -19,6 +19,46 @@
 #ifndef _INTEGRAL_IMAGE_H
 #define _INTEGRAL_IMAGE_H
 
+#include "face_object.h"
+
+/* one row of the integral image: dst[j] = sum(src[0..j]) + prev[j], prev is NULL for the first row */
+typedef void (*integral_row_t) (unsigned int *dst, const unsigned int *prev, const unsigned char *src, int width);
+extern integral_row_t pf_integral_row;
+
+/* every row kernel the cpu runs, plain c first, so they can all be checked against it */
+struct integral_row_kernel {
+    const char *name;
+    integral_row_t row;
+};
+#define INTEGRAL_MAX_ROW_KERNELS 4
+extern struct integral_row_kernel integral_row_kernels[INTEGRAL_MAX_ROW_KERNELS];
+extern int num_integral_row_kernels;
+
+/* converts one row of a packed format to 8 bits luma, NULL for formats with a luma plane */
+typedef void (*luma_row_t) (unsigned char *dst, const unsigned char *src, int width);
+extern luma_row_t pf_luma_row[FACE_FORMAT_MAX];
+
+/* every luma kernel the cpu runs, the plain c one of each format first */
+struct luma_row_kernel {
+    const char *name;
+    enum face_format format;
+    luma_row_t row;
+};
+#define LUMA_MAX_ROW_KERNELS 16
+extern struct luma_row_kernel luma_row_kernels[LUMA_MAX_ROW_KERNELS];
+extern int num_luma_row_kernels;
+
+int face_format_pixel_bytes(enum face_format format);
+
 void face_detector_gen_integral_image(unsigned int *i_data, unsigned char *data, int width, int height);
+/* same as above but must be reached by every thread of the calling OpenMP team,
+ * the rows are split into blocks integrated in parallel then fixed up with the column carries.
+ * Source and destination rows are stride elements apart so a region of a frame can be integrated,
+ * colour formats are converted a row at a time on the way in, into luma which holds luma_rows
+ * rows of width bytes, one per row block, so at most luma_rows blocks are integrated in parallel */
+void face_detector_gen_integral_image_team(unsigned int *i_data, int i_stride, const unsigned char *data, int stride,
+        enum face_format format, int width, int height, unsigned char *luma, int luma_rows);
+/* plain c reference, the simd kernels must match it bit for bit */
+void face_detector_gen_integral_image_ref(unsigned int *i_data, unsigned char *data, int width, int height);
 
 #endif
@@ -0,0 +1,386 @@
+/*
+ * facelbp - Face detection using Multi-scale Block Local Binary Pattern algorithm
+ *
+ * Copyright (C) 2013 Keith Mok <ek9852@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <emmintrin.h>
+#ifdef CAN_COMPILE_SSSE3
+#include <tmmintrin.h>
+#endif
+#if defined(CAN_COMPILE_AVX2) || defined(CAN_COMPILE_AVX512)
+#include <immintrin.h>
+#endif
+#include "common.h"
+#include "cpu.h"
+#include "integral_image.h"
+
+__attribute__((constructor)) static void integral_image_sse2_init( void );
+
+static void
+add_row_kernel(const char *name, integral_row_t row)
+{
+    integral_row_kernels[num_integral_row_kernels].name = name;
+    integral_row_kernels[num_integral_row_kernels].row = row;
+    num_integral_row_kernels++;
+    pf_integral_row = row;
+}
+
+static void
+add_luma_kernel(const char *name, enum face_format format, luma_row_t row)
+{
+    luma_row_kernels[num_luma_row_kernels].name = name;
+    luma_row_kernels[num_luma_row_kernels].format = format;
+    luma_row_kernels[num_luma_row_kernels].row = row;
+    num_luma_row_kernels++;
+    pf_luma_row[format] = row;
+}
+
+/* all kernels keep a running row sum in a vector and wrap around exactly like the plain c */
+static inline void
+integral_row_tail(unsigned int *dst, const unsigned int *prev, const unsigned char *src, int j, int width, unsigned int rs)
+{
+    for (; j < width; j++) {
+        rs += src[j];
+        dst[j] = prev ? rs + prev[j] : rs;
+    }
+}
+
+static void
+integral_row_sse2(unsigned int *dst, const unsigned int *prev, const unsigned char *src, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i carry = zero;
+    __m128i lo, hi, x0, x1, x2, x3, t;
+    int j;
+
+    for (j = 0; j + 16 <= width; j += 16) {
+        t = _mm_loadu_si128((const __m128i *)(src + j));
+        lo = _mm_unpacklo_epi8(t, zero);
+        hi = _mm_unpackhi_epi8(t, zero);
+
+        /* prefix sum of 8 bytes fits in 16 bits */
+        lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 2));
+        hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 2));
+        lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 4));
+        hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 4));
+        lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 8));
+
+        x0 = _mm_add_epi32(_mm_unpacklo_epi16(lo, zero), carry);
+        x1 = _mm_add_epi32(_mm_unpackhi_epi16(lo, zero), carry);
+        t = _mm_shuffle_epi32(x1, 0xff);
+        x2 = _mm_add_epi32(_mm_unpacklo_epi16(hi, zero), t);
+        x3 = _mm_add_epi32(_mm_unpackhi_epi16(hi, zero), t);
+        carry = _mm_shuffle_epi32(x3, 0xff);
+
+        if (prev) {
+            x0 = _mm_add_epi32(x0, _mm_loadu_si128((const __m128i *)(prev + j)));
+            x1 = _mm_add_epi32(x1, _mm_loadu_si128((const __m128i *)(prev + j + 4)));
+            x2 = _mm_add_epi32(x2, _mm_loadu_si128((const __m128i *)(prev + j + 8)));
+            x3 = _mm_add_epi32(x3, _mm_loadu_si128((const __m128i *)(prev + j + 12)));
+        }
+        _mm_storeu_si128((__m128i *)(dst + j), x0);
+        _mm_storeu_si128((__m128i *)(dst + j + 4), x1);
+        _mm_storeu_si128((__m128i *)(dst + j + 8), x2);
+        _mm_storeu_si128((__m128i *)(dst + j + 12), x3);
+    }
+    integral_row_tail(dst, prev, src, j, width, _mm_cvtsi128_si32(carry));
+}
+
+#ifdef CAN_COMPILE_AVX2
+__attribute__((target("avx2"))) static inline __m256i
+prefix_sum_avx2(__m256i x)
+{
+    __m256i t;
+
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+    /* carry the low 128 bits lane total into the high lane */
+    t = _mm256_shuffle_epi32(x, 0xff);
+    t = _mm256_permute2x128_si256(t, t, 0x08);
+    return _mm256_add_epi32(x, t);
+}
+
+__attribute__((target("avx2"))) static void
+integral_row_avx2(unsigned int *dst, const unsigned int *prev, const unsigned char *src, int width)
+{
+    const __m256i last = _mm256_set1_epi32(7);
+    __m256i carry = _mm256_setzero_si256();
+    __m256i x0, x1;
+    int j;
+
+    for (j = 0; j + 16 <= width; j += 16) {
+        x0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + j)));
+        x1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + j + 8)));
+
+        x0 = _mm256_add_epi32(prefix_sum_avx2(x0), carry);
+        carry = _mm256_permutevar8x32_epi32(x0, last);
+        x1 = _mm256_add_epi32(prefix_sum_avx2(x1), carry);
+        carry = _mm256_permutevar8x32_epi32(x1, last);
+
+        if (prev) {
+            x0 = _mm256_add_epi32(x0, _mm256_loadu_si256((const __m256i *)(prev + j)));
+            x1 = _mm256_add_epi32(x1, _mm256_loadu_si256((const __m256i *)(prev + j + 8)));
+        }
+        _mm256_storeu_si256((__m256i *)(dst + j), x0);
+        _mm256_storeu_si256((__m256i *)(dst + j + 8), x1);
+    }
+    integral_row_tail(dst, prev, src, j, width, _mm256_cvtsi256_si32(carry));
+}
+#endif
+
+#ifdef CAN_COMPILE_AVX512
+__attribute__((target("avx512f"))) static inline __m512i
+prefix_sum_avx512(__m512i x)
+{
+    const __m512i zero = _mm512_setzero_si512();
+
+    x = _mm512_add_epi32(x, _mm512_alignr_epi32(x, zero, 15));
+    x = _mm512_add_epi32(x, _mm512_alignr_epi32(x, zero, 14));
+    x = _mm512_add_epi32(x, _mm512_alignr_epi32(x, zero, 12));
+    x = _mm512_add_epi32(x, _mm512_alignr_epi32(x, zero, 8));
+    return x;
+}
+
+__attribute__((target("avx512f"))) static void
+integral_row_avx512(unsigned int *dst, const unsigned int *prev, const unsigned char *src, int width)
+{
+    const __m512i last = _mm512_set1_epi32(15);
+    __m512i carry = _mm512_setzero_si512();
+    __m512i x0, x1;
+    int j;
+
+    for (j = 0; j + 32 <= width; j += 32) {
+        x0 = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(src + j)));
+        x1 = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(src + j + 16)));
+
+        x0 = _mm512_add_epi32(prefix_sum_avx512(x0), carry);
+        carry = _mm512_permutexvar_epi32(last, x0);
+        x1 = _mm512_add_epi32(prefix_sum_avx512(x1), carry);
+        carry = _mm512_permutexvar_epi32(last, x1);
+
+        if (prev) {
+            x0 = _mm512_add_epi32(x0, _mm512_loadu_si512(prev + j));
+            x1 = _mm512_add_epi32(x1, _mm512_loadu_si512(prev + j + 16));
+        }
+        _mm512_storeu_si512(dst + j, x0);
+        _mm512_storeu_si512(dst + j + 16, x1);
+    }
+    integral_row_tail(dst, prev, src, j, width, _mm_cvtsi128_si32(_mm512_castsi512_si128(carry)));
+}
+#endif
+
+/* luma extraction, must give the same bytes as the plain c in integral_image.cc */
+#define R2Y 4899
+#define G2Y 9617
+#define B2Y 1868
+#define Y_SHIFT 14
+
+static void
+luma_row_yuyv_sse2(unsigned char *dst, const unsigned char *src, int width)
+{
+    const __m128i mask = _mm_set1_epi16(0xff);
+    __m128i a, b;
+    int j;
+
+    for (j = 0; j + 16 <= width; j += 16) {
+        a = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + j * 2)), mask);
+        b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + j * 2 + 16)), mask);
+        _mm_storeu_si128((__m128i *)(dst + j), _mm_packus_epi16(a, b));
+    }
+    for (; j < width; j++) {
+        dst[j] = src[j * 2];
+    }
+}
+
+static void
+luma_row_uyvy_sse2(unsigned char *dst, const unsigned char *src, int width)
+{
+    __m128i a, b;
+    int j;
+
+    for (j = 0; j + 16 <= width; j += 16) {
+        a = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(src + j * 2)), 8);
+        b = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(src + j * 2 + 16)), 8);
+        _mm_storeu_si128((__m128i *)(dst + j), _mm_packus_epi16(a, b));
+    }
+    for (; j < width; j++) {
+        dst[j] = src[j * 2 + 1];
+    }
+}
+
+/* 4 pixels of 4 bytes: (c0, c2) weight the even bytes, (c1, c3) the odd ones */
+static inline __m128i
+luma4_rgba_sse2(__m128i v, __m128i w_even, __m128i w_odd)
+{
+    const __m128i mask = _mm_set1_epi16(0xff);
+    const __m128i round = _mm_set1_epi32(1 << (Y_SHIFT - 1));
+    __m128i even = _mm_and_si128(v, mask);
+    __m128i odd = _mm_and_si128(_mm_srli_epi16(v, 8), mask);
+
+    v = _mm_add_epi32(_mm_madd_epi16(even, w_even), _mm_madd_epi16(odd, w_odd));
+    return _mm_srli_epi32(_mm_add_epi32(v, round), Y_SHIFT);
+}
+
+static inline void
+luma_row_4bytes_sse2(unsigned char *dst, const unsigned char *src, int width, int r_weight, int b_weight)
+{
+    const __m128i w_even = _mm_set_epi16(b_weight, r_weight, b_weight, r_weight, b_weight, r_weight, b_weight, r_weight);
+    const __m128i w_odd = _mm_set_epi16(0, G2Y, 0, G2Y, 0, G2Y, 0, G2Y);
+    __m128i y0, y1, y2, y3;
+    int j;
+
+    for (j = 0; j + 16 <= width; j += 16) {
+        y0 = luma4_rgba_sse2(_mm_loadu_si128((const __m128i *)(src + j * 4)), w_even, w_odd);
+        y1 = luma4_rgba_sse2(_mm_loadu_si128((const __m128i *)(src + j * 4 + 16)), w_even, w_odd);
+        y2 = luma4_rgba_sse2(_mm_loadu_si128((const __m128i *)(src + j * 4 + 32)), w_even, w_odd);
+        y3 = luma4_rgba_sse2(_mm_loadu_si128((const __m128i *)(src + j * 4 + 48)), w_even, w_odd);
+        _mm_storeu_si128((__m128i *)(dst + j), _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3)));
+    }
+    for (; j < width; j++) {
+        const unsigned char *p = src + j * 4;
+        dst[j] = (p[0] * r_weight + p[1] * G2Y + p[2] * b_weight + (1 << (Y_SHIFT - 1))) >> Y_SHIFT;
+    }
+}
+
+static void
+luma_row_rgba_sse2(unsigned char *dst, const unsigned char *src, int width)
+{
+    luma_row_4bytes_sse2(dst, src, width, R2Y, B2Y);
+}
+
+static void
+luma_row_bgra_sse2(unsigned char *dst, const unsigned char *src, int width)
+{
+    luma_row_4bytes_sse2(dst, src, width, B2Y, R2Y);
+}
+
+#ifdef CAN_COMPILE_SSSE3
+/* 4 pixels of 3 bytes starting at byte o of v, first and third bytes weighted by w0/w2 */
+#define SHUF_RG(o) _mm_setr_epi8(o, -1, o + 1, -1, o + 3, -1, o + 4, -1, o + 6, -1, o + 7, -1, o + 9, -1, o + 10, -1)
+#define SHUF_B(o)  _mm_setr_epi8(o + 2, -1, -1, -1, o + 5, -1, -1, -1, o + 8, -1, -1, -1, o + 11, -1, -1, -1)
+
+__attribute__((target("ssse3"))) static inline __m128i
+luma4_rgb_ssse3(__m128i v, __m128i shuf_rg, __m128i shuf_b, __m128i w_rg, __m128i w_b)
+{
+    const __m128i round = _mm_set1_epi32(1 << (Y_SHIFT - 1));
+    __m128i y;
+
+    y = _mm_add_epi32(_mm_madd_epi16(_mm_shuffle_epi8(v, shuf_rg), w_rg),
+                      _mm_madd_epi16(_mm_shuffle_epi8(v, shuf_b), w_b));
+    return _mm_srli_epi32(_mm_add_epi32(y, round), Y_SHIFT);
+}
+
+__attribute__((target("ssse3"))) static inline void
+luma_row_3bytes_ssse3(unsigned char *dst, const unsigned char *src, int width, int w0, int w2)
+{
+    const __m128i shuf_rg0 = SHUF_RG(0), shuf_b0 = SHUF_B(0);
+    const __m128i shuf_rg4 = SHUF_RG(4), shuf_b4 = SHUF_B(4);
+    const __m128i w_rg = _mm_set_epi16(G2Y, w0, G2Y, w0, G2Y, w0, G2Y, w0);
+    const __m128i w_b = _mm_set_epi16(0, w2, 0, w2, 0, w2, 0, w2);
+    __m128i y0, y1, y2, y3;
+    int j;
+
+    /* 8 pixels are 24 bytes, read as two overlapping loads */
+    for (j = 0; j + 16 <= width; j += 16) {
+        const unsigned char *p = src + j * 3;
+        y0 = luma4_rgb_ssse3(_mm_loadu_si128((const __m128i *)p), shuf_rg0, shuf_b0, w_rg, w_b);
+        y1 = luma4_rgb_ssse3(_mm_loadu_si128((const __m128i *)(p + 8)), shuf_rg4, shuf_b4, w_rg, w_b);
+        y2 = luma4_rgb_ssse3(_mm_loadu_si128((const __m128i *)(p + 24)), shuf_rg0, shuf_b0, w_rg, w_b);
+        y3 = luma4_rgb_ssse3(_mm_loadu_si128((const __m128i *)(p + 32)), shuf_rg4, shuf_b4, w_rg, w_b);
+        _mm_storeu_si128((__m128i *)(dst + j), _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3)));
+    }
+    for (; j < width; j++) {
+        const unsigned char *p = src + j * 3;
+        dst[j] = (p[0] * w0 + p[1] * G2Y + p[2] * w2 + (1 << (Y_SHIFT - 1))) >> Y_SHIFT;
+    }
+}
+
+__attribute__((target("ssse3"))) static void
+luma_row_rgb_ssse3(unsigned char *dst, const unsigned char *src, int width)
+{
+    luma_row_3bytes_ssse3(dst, src, width, R2Y, B2Y);
+}
+
+__attribute__((target("ssse3"))) static void
+luma_row_bgr_ssse3(unsigned char *dst, const unsigned char *src, int width)
+{
+    luma_row_3bytes_ssse3(dst, src, width, B2Y, R2Y);
+}
+#endif
+
+#ifdef DEBUG
+/* compare the selected kernel with the plain c reference on an odd sized frame */
+static int
+integral_row_check(void)
+{
+    const int width = 131, height = 7;
+    unsigned char data[width * height];
+    unsigned int ref[width * height], out[width * height];
+    int i;
+
+    srand(1);
+    for (i = 0; i < width * height; i++)
+        data[i] = rand() & 0xff;
+
+    face_detector_gen_integral_image_ref(ref, data, width, height);
+    face_detector_gen_integral_image(out, data, width, height);
+
+    return memcmp(ref, out, sizeof(ref));
+}
+#endif
+
+static void integral_image_sse2_init(void)
+{
+    unsigned int flags = cpu_features();
+#ifdef DEBUG
+    integral_row_t plain_c = pf_integral_row;
+#endif
+
+    if (flags & CPU_FEATURE_SSE2) {
+        add_row_kernel("sse2", integral_row_sse2);
+        add_luma_kernel("sse2", FACE_FORMAT_YUYV, luma_row_yuyv_sse2);
+        add_luma_kernel("sse2", FACE_FORMAT_UYVY, luma_row_uyvy_sse2);
+        add_luma_kernel("sse2", FACE_FORMAT_RGBA, luma_row_rgba_sse2);
+        add_luma_kernel("sse2", FACE_FORMAT_BGRA, luma_row_bgra_sse2);
+    }
+#ifdef CAN_COMPILE_SSSE3
+    if (flags & CPU_FEATURE_SSSE3) {
+        add_luma_kernel("ssse3", FACE_FORMAT_RGB, luma_row_rgb_ssse3);
+        add_luma_kernel("ssse3", FACE_FORMAT_BGR, luma_row_bgr_ssse3);
+    }
+#endif
+#ifdef CAN_COMPILE_AVX2
+    if (flags & CPU_FEATURE_AVX2) {
+        add_row_kernel("avx2", integral_row_avx2);
+    }
+#endif
+#ifdef CAN_COMPILE_AVX512
+    if (flags & CPU_FEATURE_AVX512) {
+        add_row_kernel("avx512", integral_row_avx512);
+    }
+#endif
+
+#ifdef DEBUG
+    if (integral_row_check()) {
+        ALOGE("SIMD integral image mismatch, fallback to plain c");
+        pf_integral_row = plain_c;
+    }
+#endif
+}
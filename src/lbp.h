@@ -19,14 +19,48 @@
 #ifndef _LBP_H
 #define _LBP_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include "face_object.h"
 
 struct lbp_task {
     int x;
     int y;
     float scale;
+    int scale_idx; /* into the per scale geometry tables */
 };
 
+/* The windows of one scale on a regular grid, scans are a list of them instead of
+ * one lbp_task per window. Window (gx, gy) sits at (x + gx * step_x, y + gy * step_y)
+ * and is task first + gx * grid_h + gy of the scan. lbp.cl reads the same layout. */
+struct lbp_range {
+    int x;
+    int y;
+    int step_x;
+    int step_y;
+    int grid_w; /* both 0 for no windows */
+    int grid_h;
+    float scale;
+    int scale_idx;
+    unsigned int first;
+};
+
+/* range of task i of a scan, the last one starting at or before it skips the empty ranges */
+static inline const struct lbp_range *
+lbp_find_range(const struct lbp_range *r, int num_ranges, unsigned int i)
+{
+    int lo = 0, hi = num_ranges;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (r[mid].first <= i)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return &r[lo - 1];
+}
+
 struct lbp_rect {
     int x;
     int y;
@@ -34,6 +68,24 @@ struct lbp_rect {
     int h;
 };
 
+/* The 4x4 corners of a rect at one scale, relative to the window origin.
+ * Corner (j, k) sits at img[off_y[k] + off_x[j]] and is interpolated with
+ * weights ax/bx along x and ay/by along y, fractions of float coordinates so a float
+ * holds them. There is one per weak classifier and scale, the scans read it along with
+ * the cascade, so keep it small. */
+struct lbp_rect_geom {
+    int off_x[4];
+    int off_y[4]; /* already multiplied by the integral image stride */
+    float ax[4]; /* x2 - x */
+    float bx[4]; /* x - x1 */
+    float ay[4];
+    float by[4];
+    unsigned int fx[4]; /* bx, by in LBP_FIXED_SHIFT bits fixed point */
+    unsigned int fy[4];
+};
+
+#define LBP_FIXED_SHIFT 16
+
 struct weak_classifier {
     int rect_idx;
     int32_t lbpmap[8]; /* loading need to be singed */
@@ -47,6 +99,75 @@ struct stage {
     struct weak_classifier *classifiers;
 };
 
+/* The cascade packed for the evaluators in one LBP_ARENA_ALIGN aligned block.
+ * Every stage starts on a cache line with its header, followed by its weak classifiers
+ * as struct of arrays, each array stride words long:
+ *
+ *     pos[] neg[] lbpmap[0][] .. lbpmap[7][] rect_x[] rect_y[] rect_w[] rect_h[] reject[] accept[]
+ *
+ * so a stage is one contiguous run of cache lines. The rect is inlined, classifier j of
+ * a stage uses entry first + j of the geometry tables. lbp.cl reads the same layout.
+ *
+ * reject[j] and accept[j] bound the sum of the first j weak classifiers: below reject[j]
+ * the stage fails whatever the rest return, at or above accept[j] it passes. They leave
+ * room for the float rounding of the remaining additions so the outcome is the same as
+ * summing them all. */
+#define LBP_ARENA_ALIGN 64
+#define LBP_ARENA_LINE 16 /* words per cache line */
+
+enum {
+    LBP_ARENA_POS = 0,
+    LBP_ARENA_NEG,
+    LBP_ARENA_LBPMAP,
+    LBP_ARENA_RECT_X = LBP_ARENA_LBPMAP + 8,
+    LBP_ARENA_RECT_Y,
+    LBP_ARENA_RECT_W,
+    LBP_ARENA_RECT_H,
+    LBP_ARENA_REJECT,
+    LBP_ARENA_ACCEPT,
+    LBP_ARENA_ARRAYS
+};
+
+struct lbp_arena_stage {
+    float stage_threshold;
+    int num_weak_classifiers;
+    int first; /* of the stage's classifiers in the whole cascade */
+    int stride; /* num_weak_classifiers rounded up to LBP_ARENA_LINE */
+    int next; /* words from this header to the next one */
+    int pad[LBP_ARENA_LINE - 5];
+};
+
+struct lbp_arena {
+    struct lbp_arena_stage *s; /* first stage, start of the block */
+    size_t size; /* bytes */
+    int num_classifiers;
+};
+
+static inline const struct lbp_arena_stage *
+lbp_arena_next(const struct lbp_arena_stage *s)
+{
+    return (const struct lbp_arena_stage *)((const int32_t *)s + s->next);
+}
+
+static inline const int32_t *
+lbp_arena_array(const struct lbp_arena_stage *s, int array)
+{
+    return (const int32_t *)(s + 1) + array * s->stride;
+}
+
+/* result of weak classifier j for lbp_code */
+static inline float
+lbp_arena_weak(const struct lbp_arena_stage *s, int j, int lbp_code)
+{
+    const int32_t *lbpmap = lbp_arena_array(s, LBP_ARENA_LBPMAP + (lbp_code >> 5));
+
+    if (lbpmap[j] & (1 << (lbp_code & 31))) {
+        return ((const float *)lbp_arena_array(s, LBP_ARENA_NEG))[j];
+    } else {
+        return ((const float *)lbp_arena_array(s, LBP_ARENA_POS))[j];
+    }
+}
+
 struct lbp_data {
     int feature_width;
     int feature_height;
@@ -54,6 +175,7 @@ struct lbp_data {
     struct stage *s;
     int num_rects;
     struct lbp_rect *r;
+    struct lbp_arena arena; /* s and r packed, what the evaluators read */
 };
 
 struct lbp_para {
@@ -63,12 +185,37 @@ struct lbp_para {
     float tracking_scale_down;
     float tracking_scale_up;
     float tracking_offset; // width percentage
+    int tracking_quantum; // face sizes snap to it, so search grids are reused while faces barely move
+    int tracking_predict; // search where the faces are heading, narrower while the predictions hold
+    float tracking_predicted_offset; // ... down to this search box, width percentage
+    float tracking_predicted_scale_down; // ... and this scale range
+    float tracking_predicted_scale_up;
     float eps;
     int group_threshold;
     int min_face_width;
+    int max_face_width; // 0 for no limit
+    int stage_major; // run a tile of windows stage by stage, 0 for window by window
+    int tile_windows; // windows per tile, at most LBP_MAX_TILE
+    int early_exit; // stop a stage once its outcome is certain, same results either way
+    int coarse_step; // full scans try every coarse_step-th window first, 1 for all of them
+    int refine_stage; // coarse windows past this many stages get their neighbours scanned
+    int threads; // scan threads, 0 for the OpenMP default or every cpu for the pool
+    int thread_pool; // scan on the work stealing pool instead of OpenMP
+    size_t block_bytes; // dense full scans go block by block, 0 for column by column
+    int stop_faces; // full scans go from the largest scale down and stop at this many faces
+    int stop_width; // ... or once a face at least this wide is found, both 0 scan everything
+    int scan_slices; // each processed frame tracks and scans one of this many slices of the full scan
+    int motion_block; // full scans only scan windows over blocks of this size that changed, 0 scans all
+    int motion_threshold; // mean change of a block, in grey levels, before it counts as changed
 };
 
-typedef float (*lbp_classify_t) (struct lbp_rect *r, struct weak_classifier *c, unsigned int *img, int x, int y, int width, int height, float scale);
-extern lbp_classify_t pf_lbp_classify;
+/* Evaluates n windows of one scale at img + origin[i] through data->arena, g is the
+ * geometry table of the scale in arena order.
+ * The survivors are moved to the front of origin and idx, returns how many there are.
+ * The weak classifier work is added to stats.
+ * Set to the best evaluator the cpu runs, window by window or stage by stage. */
+typedef int (*lbp_scan_batch_t) (const struct lbp_data *data, const struct lbp_rect_geom *g, const unsigned int *img, int width, int *origin, int *idx, int n, struct face_eval_stats *stats);
+extern lbp_scan_batch_t pf_lbp_scan_depth_first;
+extern lbp_scan_batch_t pf_lbp_scan_batch;
 
 #endif
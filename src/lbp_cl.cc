@@ -31,18 +31,11 @@
 #endif
 #include <vector>
 #include "common.h"
-#include "group_rectangle.h"
 #include "lbp.h"
 
 #define CL_FILE_PATH "lbp.cl"
 #define CL_IMAGE_FILE_PATH "lbp_image.cl"
 
-struct cl_stage {
-    float stage_threshold;
-    int num_weak_classifiers;
-    int classifier_start_index;
-};
-
 struct lbp_cl {
     cl_device_id device_id;             // compute device id 
     cl_context context;                 // compute context
@@ -55,13 +48,13 @@ struct lbp_cl {
     int cl_image_support;
     cl_mem int_texture;
 
-    std::vector<struct lbp_task> *full_tasks; // reference to full scan
+    std::vector<struct lbp_range> *full_ranges; // reference to full scan
+    unsigned int full_tasks;
 
-    cl_mem input_rect;
-    cl_mem input_classifier;
-    cl_mem input_stage;
-    cl_mem input_task;
-    cl_mem input_subtask;
+    cl_mem input_arena;
+    cl_mem input_ranges;
+    cl_mem input_subranges; // tracking, grown when a scan has more ranges
+    size_t subranges_size;
     cl_mem input_img;
     cl_mem output_result_counter;
     cl_mem output_result;
@@ -100,18 +93,17 @@ load_cl_file(size_t *len, const char *file)
 
 struct lbp_cl *
 lbp_cl_init(struct lbp_data *data, struct lbp_para *para, 
-    std::vector<struct lbp_task> *full_tasks, int width, int height)
+    std::vector<struct lbp_range> *full_ranges, int width, int height)
 {
     struct lbp_cl *cl;
-    std::vector<struct weak_classifier> classifiers;
-    std::vector<struct cl_stage> stages;
-    int i, j;
     int err;
+    int num_ranges = full_ranges->size();
 
     cl = (struct lbp_cl *)calloc(1, sizeof(struct lbp_cl));
 
     cl->para = *para;
-    cl->full_tasks = full_tasks;
+    cl->full_ranges = full_ranges;
+    cl->full_tasks = full_ranges->empty() ? 0 : full_ranges->back().first + full_ranges->back().grid_w * full_ranges->back().grid_h;
 
     cl_platform_id platform0;
     err = clGetPlatformIDs(1, &platform0, NULL);
@@ -199,7 +191,7 @@ lbp_cl_init(struct lbp_data *data, struct lbp_para *para,
     }
 
     char build_options[64];
-    sprintf(build_options, "-DNUM_STAGES=%u -DWIDTH=%u", data->num_stages, width); 
+    sprintf(build_options, "-DNUM_STAGES=%u -DWIDTH=%u -DARENA_LINE=%u", data->num_stages, width, LBP_ARENA_LINE);
  
     err = clBuildProgram(cl->program, 0, NULL, build_options, NULL, NULL);
     if (err != CL_SUCCESS) {
@@ -218,71 +210,43 @@ lbp_cl_init(struct lbp_data *data, struct lbp_para *para,
         goto err4;
     }
  
-    /* flatten the stages pass in */
-    for (i = 0; i < data->num_stages; i++) {
-        struct cl_stage s;
-        s.stage_threshold = data->s[i].stage_threshold;
-        s.num_weak_classifiers = data->s[i].num_weak_classifiers;
-        if (i > 0) {
-            s.classifier_start_index = stages[i - 1].classifier_start_index;
-            s.classifier_start_index += stages[i - 1].num_weak_classifiers;
-        } else {
-            s.classifier_start_index = 0;
-        }
-        for (j = 0; j < data->s[i].num_weak_classifiers; j++) {
-            struct weak_classifier c;
-            c = data->s[i].classifiers[j];
-            classifiers.push_back(c);
-        }
-        stages.push_back(s);
-    }
-    
-    cl->input_rect = clCreateBuffer(cl->context,  CL_MEM_READ_ONLY,  sizeof(struct lbp_rect) * data->num_rects, NULL, NULL);
-    cl->input_classifier = clCreateBuffer(cl->context,  CL_MEM_READ_ONLY,  sizeof(struct weak_classifier) * classifiers.size(), NULL, NULL);
-    cl->input_stage = clCreateBuffer(cl->context,  CL_MEM_READ_ONLY,  sizeof(struct cl_stage) * data->num_stages, NULL, NULL);
-    cl->input_task = clCreateBuffer(cl->context,  CL_MEM_READ_ONLY,  sizeof(struct lbp_task) * cl->full_tasks->size(), NULL, NULL);
-    cl->input_subtask = clCreateBuffer(cl->context,  CL_MEM_READ_ONLY,  sizeof(struct lbp_task) * cl->full_tasks->size(), NULL, NULL);
+    /* the packed cascade goes up as it is */
+    cl->input_arena = clCreateBuffer(cl->context,  CL_MEM_READ_ONLY,  data->arena.size, NULL, NULL);
+    /* a few descriptors per scale, the kernel works out its window from them */
+    cl->input_ranges = clCreateBuffer(cl->context,  CL_MEM_READ_ONLY,  sizeof(struct lbp_range) * (num_ranges + 1), NULL, NULL);
+    cl->subranges_size = num_ranges + 1;
+    cl->input_subranges = clCreateBuffer(cl->context,  CL_MEM_READ_ONLY,  sizeof(struct lbp_range) * cl->subranges_size, NULL, NULL);
     cl->input_img = clCreateBuffer(cl->context,  CL_MEM_READ_ONLY,  sizeof(unsigned int) * width * height, NULL, NULL);
     cl->output_result_counter = clCreateBuffer(cl->context,  CL_MEM_WRITE_ONLY,  sizeof(unsigned int), NULL, NULL);
-    cl->output_result = clCreateBuffer(cl->context,  CL_MEM_WRITE_ONLY,  sizeof(unsigned int) * cl->full_tasks->size(), NULL, NULL);
+    cl->output_result = clCreateBuffer(cl->context,  CL_MEM_WRITE_ONLY,  sizeof(unsigned int) * (cl->full_tasks + 1), NULL, NULL);
 
-    if (!cl->input_rect || !cl->input_classifier ||
-        !cl->input_stage || !cl->input_task || !cl->input_subtask ||
+    if (!cl->input_arena || !cl->input_ranges || !cl->input_subranges ||
         !cl->input_img || !cl->output_result_counter ||
         !cl->output_result) {
         ALOGE("Failed to allocate device memory!");
         goto err6;
     }    
-    err = clEnqueueWriteBuffer(cl->commands, cl->input_rect, CL_TRUE, 0, sizeof(struct lbp_rect) * data->num_rects, data->r, 0, NULL, NULL);
+    err = clEnqueueWriteBuffer(cl->commands, cl->input_arena, CL_TRUE, 0, data->arena.size, data->arena.s, 0, NULL, NULL);
     if (err != CL_SUCCESS) {
         ALOGE("Failed to write to source array!");
         goto err6;
     }
-    err = clEnqueueWriteBuffer(cl->commands, cl->input_classifier, CL_TRUE, 0, sizeof(struct weak_classifier) * classifiers.size(), classifiers.data(), 0, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        ALOGE("Failed to write to source array!");
-        goto err6;
-    }
-    err = clEnqueueWriteBuffer(cl->commands, cl->input_stage, CL_TRUE, 0, sizeof(struct cl_stage) * data->num_stages, stages.data(), 0, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        ALOGE("Failed to write to source array!");
-        goto err6;
-    }
-    err = clEnqueueWriteBuffer(cl->commands, cl->input_task, CL_TRUE, 0, sizeof(struct lbp_task) * cl->full_tasks->size(), cl->full_tasks->data(), 0, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        ALOGE("Failed to write to source array!");
-        goto err6;
+    if (num_ranges) {
+        err = clEnqueueWriteBuffer(cl->commands, cl->input_ranges, CL_TRUE, 0, sizeof(struct lbp_range) * num_ranges, full_ranges->data(), 0, NULL, NULL);
+        if (err != CL_SUCCESS) {
+            ALOGE("Failed to write to source array!");
+            goto err6;
+        }
     }
-    err = clSetKernelArg(cl->kernel, 0, sizeof(cl_mem), &cl->input_rect);
-    err |= clSetKernelArg(cl->kernel, 1, sizeof(cl_mem), &cl->input_classifier);
-    err |= clSetKernelArg(cl->kernel, 2, sizeof(cl_mem), &cl->input_stage);
-    err |= clSetKernelArg(cl->kernel, 3, sizeof(cl_mem), &cl->input_task);
-    err |= clSetKernelArg(cl->kernel, 4, sizeof(cl_mem), &cl->output_result_counter);
-    err |= clSetKernelArg(cl->kernel, 5, sizeof(cl_mem), &cl->output_result);
+    err = clSetKernelArg(cl->kernel, 0, sizeof(cl_mem), &cl->input_arena);
+    err |= clSetKernelArg(cl->kernel, 1, sizeof(cl_mem), &cl->input_ranges);
+    err |= clSetKernelArg(cl->kernel, 2, sizeof(int), &num_ranges);
+    err |= clSetKernelArg(cl->kernel, 3, sizeof(cl_mem), &cl->output_result_counter);
+    err |= clSetKernelArg(cl->kernel, 4, sizeof(cl_mem), &cl->output_result);
     if (cl->cl_image_support) {
-        err |= clSetKernelArg(cl->kernel, 6, sizeof(cl_mem), &cl->int_texture);
+        err |= clSetKernelArg(cl->kernel, 5, sizeof(cl_mem), &cl->int_texture);
     } else {
-        err |= clSetKernelArg(cl->kernel, 6, sizeof(cl_mem), &cl->input_img);
+        err |= clSetKernelArg(cl->kernel, 5, sizeof(cl_mem), &cl->input_img);
     }
     if (err != CL_SUCCESS) {
         ALOGE("Error: Failed to set kernel arguments! %d", err);
@@ -294,21 +258,17 @@ lbp_cl_init(struct lbp_data *data, struct lbp_para *para,
     cl->feature_width = data->feature_width;
     cl->feature_height = data->feature_height;
 
-    cl->detected_task_index = (unsigned int *)malloc(sizeof(unsigned int) * cl->full_tasks->size());
+    cl->detected_task_index = (unsigned int *)malloc(sizeof(unsigned int) * (cl->full_tasks + 1));
  
     return cl;
  
 err6:
-    if (cl->input_rect)
-        clReleaseMemObject(cl->input_rect);
-    if (cl->input_classifier)
-        clReleaseMemObject(cl->input_classifier);
-    if (cl->input_stage)
-        clReleaseMemObject(cl->input_stage);
-    if (cl->input_subtask)
-        clReleaseMemObject(cl->input_subtask);
-    if (cl->input_task)
-        clReleaseMemObject(cl->input_task);
+    if (cl->input_arena)
+        clReleaseMemObject(cl->input_arena);
+    if (cl->input_subranges)
+        clReleaseMemObject(cl->input_subranges);
+    if (cl->input_ranges)
+        clReleaseMemObject(cl->input_ranges);
     if (cl->input_img)
         clReleaseMemObject(cl->input_img);
     if (cl->output_result_counter)
@@ -333,12 +293,14 @@ err1:
  
 static int
 cl_detect(struct lbp_cl *cl, unsigned int *img, 
-    std::vector<struct lbp_task> *tasks,
+    std::vector<struct lbp_range> *ranges,
     std::vector<struct lbp_rect>& rects)
 {
     int err;
     size_t global;
-    std::vector<struct lbp_task> *cl_tasks;
+    unsigned int tasks = 0;
+    int num_ranges;
+    std::vector<struct lbp_range> *cl_ranges;
 
     err = clEnqueueWriteBuffer(cl->commands, cl->input_img, CL_TRUE, 0, sizeof(unsigned int) * cl->width * cl->height, img, 0, NULL, NULL);
     if (err != CL_SUCCESS) {
@@ -346,33 +308,51 @@ cl_detect(struct lbp_cl *cl, unsigned int *img,
         return -1;
     }
 
+    if (ranges != NULL && !ranges->empty())
+        tasks = ranges->back().first + ranges->back().grid_w * ranges->back().grid_h;
     // select to run a full run, or just scan previous results
-    if ((tasks != NULL) && (tasks->size() < cl->full_tasks->size())) {
-        if (tasks->size() == 0) {
+    if ((ranges != NULL) && (tasks < cl->full_tasks)) {
+        if (tasks == 0) {
             ALOGE("No task ?!");
             return -1;
         }
-        global  = tasks->size();
-        cl_tasks = tasks;
-        err = clEnqueueWriteBuffer(cl->commands, cl->input_subtask, CL_TRUE, 0, sizeof(struct lbp_task) * tasks->size(), tasks->data(), 0, NULL, NULL);
+        global  = tasks;
+        cl_ranges = ranges;
+        if (ranges->size() > cl->subranges_size) {
+            clReleaseMemObject(cl->input_subranges);
+            cl->subranges_size = ranges->size() * 2;
+            cl->input_subranges = clCreateBuffer(cl->context,  CL_MEM_READ_ONLY,  sizeof(struct lbp_range) * cl->subranges_size, NULL, NULL);
+            if (!cl->input_subranges) {
+                ALOGE("Failed to allocate sub ranges");
+                cl->subranges_size = 0;
+                return -1;
+            }
+        }
+        err = clEnqueueWriteBuffer(cl->commands, cl->input_subranges, CL_TRUE, 0, sizeof(struct lbp_range) * ranges->size(), ranges->data(), 0, NULL, NULL);
         if (err != CL_SUCCESS) {
-            ALOGE("Failed to write to subtask %d", err);
+            ALOGE("Failed to write to sub ranges %d", err);
             return -1;
         }
-        err = clSetKernelArg(cl->kernel, 3, sizeof(cl_mem), &cl->input_subtask);
+        err = clSetKernelArg(cl->kernel, 1, sizeof(cl_mem), &cl->input_subranges);
         if (err != CL_SUCCESS) {
-            ALOGE("Failed to set input sub task!");
+            ALOGE("Failed to set input sub ranges!");
             return -1;
         }
     } else {
-        global  = cl->full_tasks->size();
-        cl_tasks = cl->full_tasks;
-        err = clSetKernelArg(cl->kernel, 3, sizeof(cl_mem), &cl->input_task);
+        global  = cl->full_tasks;
+        cl_ranges = cl->full_ranges;
+        err = clSetKernelArg(cl->kernel, 1, sizeof(cl_mem), &cl->input_ranges);
         if (err != CL_SUCCESS) {
-            ALOGE("Failed to set input task!");
+            ALOGE("Failed to set input ranges!");
             return -1;
         }
     }
+    num_ranges = cl_ranges->size();
+    err = clSetKernelArg(cl->kernel, 2, sizeof(int), &num_ranges);
+    if (err != CL_SUCCESS) {
+        ALOGE("Failed to set input range count!");
+        return -1;
+    }
 
     // clear the result count
     unsigned int result_count = 0;
@@ -418,16 +398,17 @@ cl_detect(struct lbp_cl *cl, unsigned int *img,
         return -1;
     }
 
-    /* walk throught the indes */
+    /* walk throught the indes, the window is worked out like the kernel does */
     for (int i = 0; i < detected_rects; i++) {
+        unsigned int task = cl->detected_task_index[i];
+        const struct lbp_range *g = lbp_find_range(cl_ranges->data(), num_ranges, task);
         struct lbp_rect r;
-        r.x = (*cl_tasks)[cl->detected_task_index[i]].x;
-        r.y = (*cl_tasks)[cl->detected_task_index[i]].y;
-        r.w = cl->feature_width * (*cl_tasks)[cl->detected_task_index[i]].scale;
-        r.h = cl->feature_height * (*cl_tasks)[cl->detected_task_index[i]].scale;
+        r.x = g->x + (task - g->first) / g->grid_h * g->step_x;
+        r.y = g->y + (task - g->first) % g->grid_h * g->step_y;
+        r.w = cl->feature_width * g->scale;
+        r.h = cl->feature_height * g->scale;
         rects.push_back(r);
     }
-    face_detector_group_rectangle(rects, cl->para.group_threshold, cl->para.eps);
     
     return 0;
 }
@@ -435,10 +416,10 @@ cl_detect(struct lbp_cl *cl, unsigned int *img,
 /* we only do a subset of scan based on previous located features */
 int
 lbp_cl_tracking(struct lbp_cl *cl, unsigned int *img, 
-    std::vector<struct lbp_task> *tasks,
+    std::vector<struct lbp_range> *ranges,
     std::vector<struct lbp_rect>& rects)
 {
-    return cl_detect(cl, img, tasks, rects);
+    return cl_detect(cl, img, ranges, rects);
 }
 
 int
@@ -452,11 +433,10 @@ lbp_cl_destroy(struct lbp_cl *cl)
 {
     if (cl->int_texture)
         clReleaseMemObject(cl->int_texture);
-    clReleaseMemObject(cl->input_rect);
-    clReleaseMemObject(cl->input_classifier);
-    clReleaseMemObject(cl->input_stage);
-    clReleaseMemObject(cl->input_subtask);
-    clReleaseMemObject(cl->input_task);
+    clReleaseMemObject(cl->input_arena);
+    if (cl->input_subranges)
+        clReleaseMemObject(cl->input_subranges);
+    clReleaseMemObject(cl->input_ranges);
     clReleaseMemObject(cl->input_img);
     clReleaseMemObject(cl->output_result_counter);
     clReleaseMemObject(cl->output_result);
@@ -25,10 +25,10 @@
 struct lbp_cl;
 
 struct lbp_cl *lbp_cl_init(struct lbp_data *data, struct lbp_para *para, 
-    std::vector<struct lbp_task> *full_tasks, int width, int height);
+    std::vector<struct lbp_range> *full_ranges, int width, int height);
 int lbp_cl_detect(struct lbp_cl *cl, unsigned int *img, std::vector<struct lbp_rect>& rects);
 int lbp_cl_tracking(struct lbp_cl *cl, unsigned int *img, 
-    std::vector<struct lbp_task> *tasks,
+    std::vector<struct lbp_range> *ranges,
     std::vector<struct lbp_rect>& rects);
 void lbp_cl_destroy(struct lbp_cl *cl);
 
@@ -17,14 +17,24 @@
  */
 
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <errno.h>
 #include <math.h>
+#include <float.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "lbp_detect.h"
+#include "lbp_eval.h"
+#include "integral_image.h"
 #include "group_rectangle.h"
 #include "lbp.h"
+#include "thread_pool.h"
 #include "common.h"
 #ifdef USE_OPENCL
 #include "lbp_cl.h"
@@ -32,319 +42,2179 @@
 
 #define DATA_FILE_PATH "frontalface.txt"
 
-/* default handler */
-static float lbp_classify(struct lbp_rect *r, struct weak_classifier *c, unsigned int *img, int x, int y, int width, int height, float scale);
-lbp_classify_t pf_lbp_classify = lbp_classify;
+/* windows scanned stage by stage together */
+#define LBP_MAX_TILE 1024
+
+/* geometry of every rect of lbp_data at one scale */
+struct lbp_scale {
+    float scale;
+    struct lbp_rect_geom *g;
+    int level_w; /* FACE_ENGINE_PYRAMID: the frame downscaled by scale */
+    int level_h;
+};
+
+/* a raw hit, task orders the hits of a scan */
+struct lbp_hit {
+    unsigned int task;
+    struct lbp_rect r;
+};
+
+/* search narrowings of predicted faces, 0 searches the whole tracking box */
+#define LBP_TRACK_LEVELS 4
+
+/* the search grid of a tracked face, kept across frames */
+struct lbp_track_face {
+    int x; /* face box, the size snapped to para.tracking_quantum */
+    int y;
+    int w;
+    int h;
+    int level; /* of the search around it */
+    int built_x; /* box the grid was built for, moves are rounded from there */
+    int built_y;
+    bool clamped; /* the search box was cut by the frame */
+    unsigned long frame; /* last tracking call that used it */
+    std::vector<struct lbp_range> ranges; /* numbered from 0 */
+};
+
+/* para.tracking_predict, where a tracked face goes */
+struct lbp_face_motion {
+    float x; /* where it was found last */
+    float y;
+    float w;
+    float h;
+    float vx; /* per frame, smoothed */
+    float vy;
+    float vw;
+    float px; /* where it was predicted to be next */
+    float py;
+    float pw;
+    float ph;
+    int level; /* predictions that held in a row, up to LBP_TRACK_LEVELS - 1 */
+    int moves; /* measured, the first one is the velocity */
+    unsigned long frame; /* last tracking call that saw it */
+};
+
+/* what one scan thread gathers, nothing is shared until end_scan */
+struct lbp_thread {
+    std::vector<struct lbp_hit> hits;
+    struct face_eval_stats stats;
+    struct face_drift drift;
+};
 
 struct lbp {
     struct lbp_data data;
     struct lbp_para para;
     int width;
     int height;
+    int max_window_w; /* largest window scanned */
+    int max_window_h;
+    enum face_engine engine;
+    lbp_scan_batch_t scan; /* evaluator of the engine and scan order, NULL compares drift */
+    struct face_drift drift; /* FACE_ENGINE_FIXED_DRIFT only */
+    struct face_eval_stats stats;
+    /* FACE_ENGINE_PYRAMID, one level at a time, rows width apart */
+    struct lbp_rect_geom *level_g; /* unscaled feature geometry */
+    unsigned char *level_img;
+    unsigned int *level_integral;
+    double *level_rows; /* two rows of width + 1 per thread of the team, build_level */
+    int level_rows_threads;
 
 #ifdef USE_OPENCL
     struct lbp_cl* cl;
 #endif
 
-    std::vector<struct lbp_rect> detected_r; /* must use new/delete instead of malloc/free because of this */
-    std::vector<struct lbp_task> tasks; /* task to scan all size and positions  */
-};
+    std::vector<struct lbp_rect> detected_r; /* must use new/delete instead of malloc/free because of this */
+    std::vector<struct lbp_range> ranges; /* full scan, ranges[k] holds the windows of scales[k] */
+    unsigned int num_tasks; /* windows of the full scan */
+    std::vector<struct lbp_scale> scales; /* scales scanned, fixed at creation */
+    /* coarse to fine full scans */
+    std::vector<struct lbp_range> coarse_ranges; /* every coarse_step-th window of ranges */
+    unsigned int num_coarse;
+    std::vector<struct lbp_range> blocks; /* para.block_bytes, ranges cut into blocks */
+    /* largest first scans */
+    std::vector<struct lbp_range> scale_range; /* the scale being scanned */
+    /* tiled scans */
+    std::vector<struct lbp_range> tile_ranges; /* ranges on the grid of the whole image */
+    std::vector<struct lbp_rect> grouped; /* the faces found so far */
+    /* tracking, the grids of the faces are reused while they stay put */
+    std::vector<struct lbp_track_face> track_faces;
+    std::vector<int> track_face_idx; /* grid of every face of the frame */
+    std::vector<struct lbp_face_motion> motions;
+    std::vector<struct face> predicted; /* boxes searched for the faces of the frame */
+    std::vector<int> predicted_level;
+    std::vector<struct lbp_range> tracking_ranges; /* every face of the frame */
+    std::vector<struct lbp_range> merge_src; /* tracking_ranges before they are merged */
+    std::vector<unsigned char> merge_mask; /* windows of the grids of one scale */
+    unsigned long track_frame;
+    unsigned long track_reused;
+    unsigned long track_translated;
+    unsigned long track_built;
+    unsigned int slice; /* of the full scan, scanned by the next face_detector_lbp_process */
+    std::vector<unsigned char> refine; /* full scan tasks around coarse windows that went deep enough */
+    std::vector<struct lbp_task> refined_tasks;
+    /* motion gated full scans, every block against the frame it last changed in */
+    bool motion_valid; /* there was one */
+    std::vector<unsigned int> block_sums; /* para.motion_block pixels square, row by row */
+    std::vector<unsigned int> changed_blocks; /* changed blocks above and left of each block corner */
+    std::vector<unsigned char> verdicts; /* full scan tasks that were hits */
+    std::vector<struct lbp_task> motion_tasks; /* the windows over changed blocks */
+    std::vector<unsigned int> motion_task_idx;
+    std::vector<struct lbp_thread> threads; /* one per scan thread */
+    std::vector<struct lbp_hit> merged_hits;
+    struct thread_pool *pool; /* para.thread_pool only, created by the first scan */
+    std::vector<int> cpus; /* the pool threads are pinned to */
+};
+
+/* along x then y on box sums, the SIMD samplers do the same operations in the same order */
+static inline double
+get_value_bilinear(const unsigned int *d0, const unsigned int *d1, double ax, double bx, double ay, double by)
+{
+    return (d0[0] * ax + d0[1] * bx) * ay + (d1[0] * ax + d1[1] * bx) * by;
+}
+
+/* interpolate along x then y without rounding, the value in 2 * LBP_FIXED_SHIFT bits
+ * fixed point. The integral image is below 2^32 and the weights add up to 1, so it fits */
+static inline uint64_t
+get_value_fixed(const unsigned int *p, int width, unsigned int fx, unsigned int fy)
+{
+    const uint64_t one = 1 << LBP_FIXED_SHIFT;
+    uint64_t top = p[0] * (one - fx) + p[1] * (uint64_t)fx;
+    uint64_t bottom = p[width] * (one - fx) + p[width + 1] * (uint64_t)fx;
+
+    return top * (one - fy) + bottom * fy;
+}
+
+static inline void
+get_block_sums(const unsigned int *i, unsigned int *p)
+{
+    /*  0  1  2  3
+     *  4  5  6  7
+     *  8  9 10 11
+     * 12 13 14 15
+     */
+    p[0] = (i[0] - i[1] - i[4] + i[5]);
+    p[1] = (i[1] - i[2] - i[5] + i[6]);
+    p[2] = (i[2] - i[3] - i[6] + i[7]);
+    p[3] = (i[4] - i[5] - i[8] + i[9]);
+    p[4] = (i[5] - i[6] - i[9] + i[10]);
+    p[5] = (i[6] - i[7] - i[10] + i[11]);
+    p[6] = (i[8] - i[9] - i[12] + i[13]);
+    p[7] = (i[9] - i[10] - i[13] + i[14]);
+    p[8] = (i[10] - i[11] - i[14] + i[15]);
+}
+
+/* The corners are interpolated on the integral image less its values on the first row
+ * and column read, box sums from the top left pixel read, and only the block sums are
+ * rounded, like the fixed point sampling. Those box sums are the same wherever the
+ * integral image starts, so tracking, which integrates from the top left of its search
+ * region, finds what a full scan does. The block sums are not negative, rounding them
+ * is adding a half and truncating */
+static void
+get_interpolated_integral_value(const struct lbp_rect_geom *g, const unsigned int *img, int width, unsigned int *p)
+{
+    const unsigned int *first = img + g->off_y[0];
+    unsigned int top[8], d[2][8];
+    double i[16];
+    int j, k, v;
+
+    for (j = 0; j < 8; j++)
+        top[j] = first[g->off_x[j / 2] + j % 2];
+    for (k = 0; k < 4; k++) {
+        for (v = 0; v < 2; v++) {
+            const unsigned int *row = img + g->off_y[k] + v * width;
+            unsigned int left = row[g->off_x[0]] - top[0];
+            for (j = 0; j < 8; j++)
+                d[v][j] = row[g->off_x[j / 2] + j % 2] - top[j] - left;
+        }
+        for (j = 0; j < 4; j++)
+            i[k * 4 + j] = get_value_bilinear(&d[0][j * 2], &d[1][j * 2], g->ax[j], g->bx[j], g->ay[k], g->by[k]);
+    }
+
+    p[0] = (int)(i[0] - i[1] - i[4] + i[5] + 0.5);
+    p[1] = (int)(i[1] - i[2] - i[5] + i[6] + 0.5);
+    p[2] = (int)(i[2] - i[3] - i[6] + i[7] + 0.5);
+    p[3] = (int)(i[4] - i[5] - i[8] + i[9] + 0.5);
+    p[4] = (int)(i[5] - i[6] - i[9] + i[10] + 0.5);
+    p[5] = (int)(i[6] - i[7] - i[10] + i[11] + 0.5);
+    p[6] = (int)(i[8] - i[9] - i[12] + i[13] + 0.5);
+    p[7] = (int)(i[9] - i[10] - i[13] + i[14] + 0.5);
+    p[8] = (int)(i[10] - i[11] - i[14] + i[15] + 0.5);
+}
+
+/* The block sums are exact before they are rounded, and so do not depend on where the
+ * integral image starts: moving its origin adds a term that only varies along x or y to
+ * every value, and those cancel out of each sum. Tracking can then integrate from the
+ * top left of its search region and still find what a full scan does */
+static void
+get_interpolated_integral_value_fixed(const struct lbp_rect_geom *g, const unsigned int *img, int width, unsigned int *p)
+{
+    const uint64_t half = 1ull << (2 * LBP_FIXED_SHIFT - 1);
+    uint64_t i[16];
+    int j, k;
+
+    for (k = 0; k < 4; k++) {
+        const unsigned int *row = img + g->off_y[k];
+        for (j = 0; j < 4; j++) {
+            i[k * 4 + j] = get_value_fixed(row + g->off_x[j], width, g->fx[j], g->fy[k]);
+        }
+    }
+    p[0] = (i[0] - i[1] - i[4] + i[5] + half) >> (2 * LBP_FIXED_SHIFT);
+    p[1] = (i[1] - i[2] - i[5] + i[6] + half) >> (2 * LBP_FIXED_SHIFT);
+    p[2] = (i[2] - i[3] - i[6] + i[7] + half) >> (2 * LBP_FIXED_SHIFT);
+    p[3] = (i[4] - i[5] - i[8] + i[9] + half) >> (2 * LBP_FIXED_SHIFT);
+    p[4] = (i[5] - i[6] - i[9] + i[10] + half) >> (2 * LBP_FIXED_SHIFT);
+    p[5] = (i[6] - i[7] - i[10] + i[11] + half) >> (2 * LBP_FIXED_SHIFT);
+    p[6] = (i[8] - i[9] - i[12] + i[13] + half) >> (2 * LBP_FIXED_SHIFT);
+    p[7] = (i[9] - i[10] - i[13] + i[14] + half) >> (2 * LBP_FIXED_SHIFT);
+    p[8] = (i[10] - i[11] - i[14] + i[15] + half) >> (2 * LBP_FIXED_SHIFT);
+}
+
+static inline int
+get_lbp_code(const unsigned int *p)
+{
+    /* 0 1 2
+     * 3 4 5 
+     * 6 7 8
+     */
+    int lbp_code = 0;
+
+    if (p[0] >= p[4]) lbp_code |= 128;
+    if (p[1] >= p[4]) lbp_code |= 64;
+    if (p[2] >= p[4]) lbp_code |= 32;
+    if (p[3] >= p[4]) lbp_code |= 1;
+    if (p[5] >= p[4]) lbp_code |= 16;
+    if (p[6] >= p[4]) lbp_code |= 2;
+    if (p[7] >= p[4]) lbp_code |= 4;
+    if (p[8] >= p[4]) lbp_code |= 8;
+    return lbp_code;
+}
+
+struct lbp_classify_float {
+    static inline int
+    code(const struct lbp_rect_geom *g, const unsigned int *img, int width)
+    {
+        unsigned int p[9];
+
+        get_interpolated_integral_value(g, img, width, p);
+        return get_lbp_code(p);
+    }
+};
+
+struct lbp_classify_fixed {
+    static inline int
+    code(const struct lbp_rect_geom *g, const unsigned int *img, int width)
+    {
+        unsigned int p[9];
+
+        get_interpolated_integral_value_fixed(g, img, width, p);
+        return get_lbp_code(p);
+    }
+};
+
+/* FACE_ENGINE_PYRAMID, the window is feature sized and all corners are on pixels */
+struct lbp_classify_integer {
+    static inline int
+    code(const struct lbp_rect_geom *g, const unsigned int *img, int /*width*/)
+    {
+        unsigned int i[16], p[9];
+        int j, k;
+
+        for (k = 0; k < 4; k++) {
+            const unsigned int *row = img + g->off_y[k];
+            for (j = 0; j < 4; j++) {
+                i[k * 4 + j] = row[g->off_x[j]];
+            }
+        }
+        get_block_sums(i, p);
+        return get_lbp_code(p);
+    }
+};
+
+/* default handlers */
+lbp_scan_batch_t pf_lbp_scan_depth_first = lbp_eval_depth_first<lbp_classify_float>;
+lbp_scan_batch_t pf_lbp_scan_batch = lbp_eval_stage_major<lbp_classify_float>;
+
+static void
+add_drift(struct face_drift *total, const struct face_drift *d)
+{
+    total->samples += d->samples;
+    total->samples_differ += d->samples_differ;
+    if (d->max_error > total->max_error)
+        total->max_error = d->max_error;
+    total->codes += d->codes;
+    total->codes_differ += d->codes_differ;
+    total->windows += d->windows;
+    total->windows_differ += d->windows_differ;
+}
+
+/* float decides, every block sum float looks at is compared with the fixed point one
+ * and the window also goes through the fixed point cascade. Only the float work is added
+ * to stats, every weak classifier of the stages it goes through */
+static int
+lbp_detect_drift(struct lbp *l, int thread, const struct lbp_rect_geom *g, const unsigned int *win, int width,
+        struct face_eval_stats *stats)
+{
+    struct face_drift *total = &l->threads[thread].drift;
+    const struct lbp_arena_stage *s = l->data.arena.s;
+    struct face_eval_stats fixed = {}; /* not counted, drift sums every classifier */
+    struct face_drift d = {};
+    unsigned int pf[9], px[9];
+    float threshold;
+    int found, i, j, k;
+
+    found = 1;
+    for (i = 0; i < l->data.num_stages && found; i++, s = lbp_arena_next(s)) {
+        threshold = 0;
+        for (j = 0; j < s->num_weak_classifiers; j++) {
+            int code;
+
+            get_interpolated_integral_value(&g[s->first + j], win, width, pf);
+            get_interpolated_integral_value_fixed(&g[s->first + j], win, width, px);
+            for (k = 0; k < 9; k++) {
+                unsigned int e = pf[k] > px[k] ? pf[k] - px[k] : px[k] - pf[k];
+                if (e) {
+                    d.samples_differ++;
+                    if (e > d.max_error)
+                        d.max_error = e;
+                }
+            }
+            d.samples += 9;
+            code = get_lbp_code(pf);
+            d.codes++;
+            if (code != get_lbp_code(px))
+                d.codes_differ++;
+            threshold += lbp_arena_weak(s, j, code);
+        }
+        stats->evaluated += s->num_weak_classifiers;
+        if (threshold < s->stage_threshold)
+            found = 0;
+    }
+    stats->windows++;
+    d.windows = 1;
+    d.windows_differ = found != lbp_eval_window<lbp_classify_fixed>(&l->data, g, win, width, &fixed);
+
+    add_drift(total, &d);
+    return found;
+}
+
+static void
+add_eval_stats(struct face_eval_stats *total, const struct face_eval_stats *stats)
+{
+    total->windows += stats->windows;
+    total->evaluated += stats->evaluated;
+    total->skipped += stats->skipped;
+    total->early_rejects += stats->early_rejects;
+    total->early_accepts += stats->early_accepts;
+    total->tracking_merged += stats->tracking_merged;
+}
+
+/* threads of the scan team or the pool */
+static int
+scan_threads(const struct lbp *l)
+{
+    if (l->para.threads > 0)
+        return l->para.threads;
+#ifdef _OPENMP
+    if (!l->para.thread_pool)
+        return omp_get_max_threads();
+#endif
+    return thread_pool_cpus();
+}
+
+/* the rows build_level interpolates the frame integral image into, only grows when
+ * the team does */
+static int
+alloc_level_rows(struct lbp *l)
+{
+    int threads = scan_threads(l);
+    double *rows;
+
+    if (l->engine != FACE_ENGINE_PYRAMID || l->level_rows_threads >= threads)
+        return 0;
+    rows = (double *)realloc(l->level_rows, (size_t)threads * 2 * (l->width + 1) * sizeof(double));
+    if (!rows) {
+        ALOGE("Cannot allocate the level rows of %d threads", threads);
+        return -ENOMEM;
+    }
+    l->level_rows = rows;
+    l->level_rows_threads = threads;
+    return 0;
+}
+
+/* index of the calling thread in the OpenMP team */
+static int
+team_thread(void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+/* every thread adds to its own buffer, nothing is shared until end_scan */
+static void
+add_lbp_object(struct lbp *l, int thread, unsigned int task, int x, int y, float scale)
+{
+    struct lbp_hit h;
+    h.task = task;
+    h.r.x = x;
+    h.r.y = y;
+    h.r.w = l->data.feature_width * scale;
+    h.r.h = l->data.feature_height * scale;
+    l->threads[thread].hits.push_back(h);
+}
+
+static void
+begin_scan(struct lbp *l)
+{
+    unsigned int i;
+
+    l->threads.resize(scan_threads(l));
+    for (i = 0; i < l->threads.size(); i++) {
+        struct face_eval_stats stats = {};
+        struct face_drift drift = {};
+
+        l->threads[i].hits.clear();
+        l->threads[i].stats = stats;
+        l->threads[i].drift = drift;
+    }
+}
+
+static bool
+hit_less(const struct lbp_hit& a, const struct lbp_hit& b)
+{
+    return a.task < b.task;
+}
+
+/* appends the hits of every thread to rects in task order, so the raw hits and the
+ * grouping do not depend on the number of threads or on how the tasks were shared,
+ * and adds up the counters of the threads */
+static void
+end_scan(struct lbp *l, std::vector<struct lbp_rect>& rects)
+{
+    unsigned int i;
+
+    l->merged_hits.clear();
+    for (i = 0; i < l->threads.size(); i++) {
+        l->merged_hits.insert(l->merged_hits.end(), l->threads[i].hits.begin(), l->threads[i].hits.end());
+        add_eval_stats(&l->stats, &l->threads[i].stats);
+        add_drift(&l->drift, &l->threads[i].drift);
+    }
+    std::sort(l->merged_hits.begin(), l->merged_hits.end(), hit_less);
+    for (i = 0; i < l->merged_hits.size(); i++) {
+        rects.push_back(l->merged_hits[i].r);
+    }
+}
+
+/* body of a scan, chunk is a tile of tile_windows tasks */
+typedef void (*scan_chunk_t) (struct lbp *l, void *job, int thread, int chunk);
+
+struct pool_job {
+    struct lbp *l;
+    scan_chunk_t fn;
+    void *job;
+};
+
+/* the pool of the scan begin_scan set up, NULL if it cannot be created */
+static struct thread_pool *
+scan_pool(struct lbp *l)
+{
+    if (l->pool && thread_pool_threads(l->pool) != (int)l->threads.size()) {
+        thread_pool_destroy(l->pool);
+        l->pool = NULL;
+    }
+    if (!l->pool) {
+        l->pool = thread_pool_create(l->threads.size());
+        if (!l->pool) {
+            ALOGE("Cannot create %d pool threads", (int)l->threads.size());
+            return NULL;
+        }
+        if (!l->cpus.empty())
+            thread_pool_set_affinity(l->pool, &l->cpus[0], l->cpus.size());
+    }
+    return l->pool;
+}
+
+static void
+pool_chunk(void *priv, int thread, int chunk)
+{
+    struct pool_job *j = (struct pool_job *)priv;
+
+    j->fn(j->l, j->job, thread, chunk);
+}
+
+/* runs fn over the chunks on the pool or an OpenMP team, prepare first builds
+ * the integral image of the region (x, y, width, height) */
+static void
+run_scan(struct lbp *l, int chunks, scan_chunk_t fn, void *job,
+        lbp_prepare_t prepare, void *priv, int x, int y, int width, int height)
+{
+    int i;
+
+    if (l->para.thread_pool && scan_pool(l)) {
+        struct pool_job j = { l, fn, job };
+
+        /* the integral image is built by an OpenMP team if there is one */
+        if (prepare) {
+            #pragma omp parallel num_threads(scan_threads(l))
+            prepare(priv, x, y, width, height);
+        }
+        thread_pool_run(l->pool, chunks, pool_chunk, &j);
+        return;
+    }
+
+    #pragma omp parallel num_threads(scan_threads(l))
+    {
+        /* the integral image is built by the same team before it scans */
+        if (prepare)
+            prepare(priv, x, y, width, height);
+
+        #pragma omp for
+        for (i = 0; i < chunks; i++) {
+            fn(l, job, team_thread(), i);
+        }
+    }
+}
+
+static inline unsigned int
+range_windows(const struct lbp_range *r)
+{
+    return r->grid_w * r->grid_h;
+}
+
+/* appends the grid_w x grid_h windows at (x, y), numbered after the ones already in ranges */
+static void
+add_range(std::vector<struct lbp_range>& ranges, int x, int y, int step_x, int step_y,
+        int grid_w, int grid_h, float scale, int scale_idx)
+{
+    struct lbp_range r;
+
+    r.x = x;
+    r.y = y;
+    r.step_x = step_x;
+    r.step_y = step_y;
+    r.grid_w = grid_h ? grid_w : 0;
+    r.grid_h = grid_w ? grid_h : 0;
+    r.scale = scale;
+    r.scale_idx = scale_idx;
+    r.first = ranges.empty() ? 0 : ranges.back().first + range_windows(&ranges.back());
+    ranges.push_back(r);
+}
+
+/* windows of a scan over ranges */
+static unsigned int
+ranges_windows(const std::vector<struct lbp_range>& ranges)
+{
+    return ranges.empty() ? 0 : ranges.back().first + range_windows(&ranges.back());
+}
+
+/* windows at origin, origin + step, ... that still fit, origin + size < limit */
+static int
+grid_count(int origin, int step, float size, float limit)
+{
+    int n;
+
+    for (n = 0; origin + size < limit; origin += step)
+        n++;
+    return n;
+}
+
+/* tasks first to first + n - 1 of a scan over ranges, worked out from the grids */
+static void
+get_tasks(const struct lbp_range *ranges, int num_ranges, unsigned int first, int n, struct lbp_task *t)
+{
+    const struct lbp_range *r = lbp_find_range(ranges, num_ranges, first);
+    int gx = (first - r->first) / r->grid_h;
+    int gy = (first - r->first) % r->grid_h;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        t[i].x = r->x + gx * r->step_x;
+        t[i].y = r->y + gy * r->step_y;
+        t[i].scale = r->scale;
+        t[i].scale_idx = r->scale_idx;
+        if (++gy < r->grid_h)
+            continue;
+        gy = 0;
+        if (++gx < r->grid_w)
+            continue;
+        gx = 0;
+        do {
+            r++;
+        } while (r < ranges + num_ranges && !r->grid_w);
+    }
+}
+
+/* scans a tile of up to LBP_MAX_TILE tasks, t[i] is task task[i] of the scan or first + i
+ * without task, the integral image has its origin at (x0, y0) of the frame */
+static void
+scan_tasks(struct lbp *l, int thread, unsigned int *img, const struct lbp_task *t, int n, unsigned int first,
+        const unsigned int *task, int x0, int y0)
+{
+    int origin[LBP_MAX_TILE], idx[LBP_MAX_TILE];
+    struct face_eval_stats stats = {};
+    int begin, end, found, i;
+
+    for (begin = 0; begin < n; begin = end) {
+        /* stage major scans want one scale */
+        for (end = begin; end < n && t[end].scale_idx == t[begin].scale_idx; end++)
+            ;
+        if (!l->scan) {
+            for (i = begin; i < end; i++) {
+                const unsigned int *win = img + (t[i].x - x0) + (t[i].y - y0) * l->width;
+                if (lbp_detect_drift(l, thread, l->scales[t[i].scale_idx].g, win, l->width, &stats))
+                    add_lbp_object(l, thread, task ? task[i] : first + i, t[i].x, t[i].y, t[i].scale);
+            }
+            continue;
+        }
+        for (i = begin; i < end; i++) {
+            origin[i - begin] = (t[i].x - x0) + (t[i].y - y0) * l->width;
+            idx[i - begin] = i;
+        }
+        stats.windows += end - begin;
+        found = l->scan(&l->data, l->scales[t[begin].scale_idx].g, img, l->width, origin, idx, end - begin, &stats);
+        for (i = 0; i < found; i++) {
+            add_lbp_object(l, thread, task ? task[idx[i]] : first + idx[i], t[idx[i]].x, t[idx[i]].y, t[idx[i]].scale);
+        }
+    }
+    add_eval_stats(&l->threads[thread].stats, &stats);
+}
+
+/* a tile of tasks for run_scan, listed in t or worked out from ranges */
+struct scan_tiles {
+    unsigned int *img;
+    const struct lbp_task *t;
+    const unsigned int *task; /* numbers of the tasks in t, NULL for their index */
+    const struct lbp_range *r;
+    int num_ranges;
+    int n;
+    int x0;
+    int y0;
+};
+
+static void
+scan_tile(struct lbp *l, void *job, int thread, int chunk)
+{
+    struct scan_tiles *s = (struct scan_tiles *)job;
+    struct lbp_task t[LBP_MAX_TILE];
+    int first = chunk * l->para.tile_windows;
+    int n = std::min(s->n - first, l->para.tile_windows);
+
+    if (s->t) {
+        scan_tasks(l, thread, s->img, s->t + first, n, first, s->task ? s->task + first : NULL, s->x0, s->y0);
+        return;
+    }
+    get_tasks(s->r, s->num_ranges, first, n, t);
+    scan_tasks(l, thread, s->img, t, n, first, NULL, s->x0, s->y0);
+}
+
+/* scans n tasks in tiles, prepare builds the integral image of the region at (x0, y0) */
+static void
+scan_tiles(struct lbp *l, unsigned int *img, const struct lbp_task *t, int n, int x0, int y0,
+        lbp_prepare_t prepare, void *priv, int width, int height)
+{
+    struct scan_tiles s = { img, t, NULL, NULL, 0, n, x0, y0 };
+
+    run_scan(l, (n + l->para.tile_windows - 1) / l->para.tile_windows, scan_tile, &s,
+            prepare, priv, x0, y0, width, height);
+}
+
+/* scans the windows of ranges in tiles, see scan_tiles */
+static void
+scan_ranges(struct lbp *l, unsigned int *img, const std::vector<struct lbp_range>& ranges, int x0, int y0,
+        lbp_prepare_t prepare, void *priv, int width, int height)
+{
+    struct scan_tiles s = { img, NULL, NULL, ranges.empty() ? NULL : &ranges[0], (int)ranges.size(), (int)ranges_windows(ranges), x0, y0 };
+
+    run_scan(l, (s.n + l->para.tile_windows - 1) / l->para.tile_windows, scan_tile, &s,
+            prepare, priv, x0, y0, width, height);
+}
+
+/* a block of the full scan, its windows go through the cascade a column at a time
+ * in tiles and keep their full scan task numbers, so the hits merge like a scan
+ * column by column would */
+static void
+scan_block(struct lbp *l, void *job, int thread, int chunk)
+{
+    const struct lbp_range *b = &l->blocks[chunk];
+    const struct lbp_range *r = &l->ranges[b->scale_idx];
+    struct lbp_task t[LBP_MAX_TILE];
+    unsigned int task[LBP_MAX_TILE];
+    unsigned int *img = (unsigned int *)job;
+    int gx, gy, n = 0;
+
+    for (gx = 0; gx < b->grid_w; gx++) {
+        for (gy = 0; gy < b->grid_h; gy++) {
+            t[n].x = b->x + gx * b->step_x;
+            t[n].y = b->y + gy * b->step_y;
+            t[n].scale = b->scale;
+            t[n].scale_idx = b->scale_idx;
+            task[n] = r->first + (t[n].x - r->x) / r->step_x * r->grid_h + (t[n].y - r->y) / r->step_y;
+            if (++n == l->para.tile_windows) {
+                scan_tasks(l, thread, img, t, n, 0, task, 0, 0);
+                n = 0;
+            }
+        }
+    }
+    if (n)
+        scan_tasks(l, thread, img, t, n, 0, task, 0, 0);
+}
+
+/* coarse pass of a tile of coarse_ranges starting at begin, data stops at refine_stage,
+ * marks the fine windows around the ones that get through */
+static void
+scan_coarse_tasks(struct lbp *l, int thread, const struct lbp_data *data, unsigned int *img, int begin, int n)
+{
+    struct lbp_task t[LBP_MAX_TILE];
+    int origin[LBP_MAX_TILE], idx[LBP_MAX_TILE];
+    struct face_eval_stats stats = {};
+    int radius = l->para.coarse_step - 1;
+    int first, last, found, i, dx, dy;
+
+    get_tasks(&l->coarse_ranges[0], l->coarse_ranges.size(), begin, n, t);
+    for (first = 0; first < n; first = last) {
+        /* the full scan grid of the scale, it starts at (0, 0) */
+        const struct lbp_range *r = &l->ranges[t[first].scale_idx];
+
+        for (last = first; last < n && t[last].scale_idx == t[first].scale_idx; last++)
+            ;
+        for (i = first; i < last; i++) {
+            origin[i - first] = t[i].x + t[i].y * l->width;
+            idx[i - first] = i;
+        }
+        stats.windows += last - first;
+        found = l->scan(data, l->scales[t[first].scale_idx].g, img, l->width, origin, idx, last - first, &stats);
+        for (i = 0; i < found; i++) {
+            int gx = t[idx[i]].x / r->step_x;
+            int gy = t[idx[i]].y / r->step_y;
+
+            for (dx = -radius; dx <= radius; dx++) {
+                if (gx + dx < 0 || gx + dx >= r->grid_w)
+                    continue;
+                for (dy = -radius; dy <= radius; dy++) {
+                    if (gy + dy < 0 || gy + dy >= r->grid_h)
+                        continue;
+                    __atomic_store_n(&l->refine[r->first + (gx + dx) * r->grid_h + gy + dy], 1, __ATOMIC_RELAXED);
+                }
+            }
+        }
+    }
+    add_eval_stats(&l->threads[thread].stats, &stats);
+}
+
+struct coarse_tiles {
+    const struct lbp_data *data;
+    unsigned int *img;
+};
+
+static void
+scan_coarse_tile(struct lbp *l, void *job, int thread, int chunk)
+{
+    struct coarse_tiles *c = (struct coarse_tiles *)job;
+    int first = chunk * l->para.tile_windows;
+
+    scan_coarse_tasks(l, thread, c->data, c->img, first, std::min((int)l->num_coarse - first, l->para.tile_windows));
+}
+
+static void
+init_rect_geom(struct lbp_rect_geom *g, const struct lbp_rect *r, float scale, int stride)
+{
+    int j;
+    /* same float arithmetic as interpolating at the window origin used to do */
+    for (j = 0; j < 4; j++) {
+        float x = r->x * scale + r->w * scale * j;
+        float y = r->y * scale + r->h * scale * j;
+        float x1 = floorf(x);
+        float y1 = floorf(y);
+
+        g->off_x[j] = (int)x1;
+        g->off_y[j] = (int)y1 * stride;
+        g->ax[j] = x1 + 1 - x;
+        g->bx[j] = x - x1;
+        g->ay[j] = y1 + 1 - y;
+        g->by[j] = y - y1;
+        g->fx[j] = lrint(g->bx[j] * (1 << LBP_FIXED_SHIFT));
+        g->fy[j] = lrint(g->by[j] * (1 << LBP_FIXED_SHIFT));
+    }
+}
+
+/* geometry of every weak classifier's rect at scale, in arena order */
+static struct lbp_rect_geom *
+init_geom_table(const struct lbp *l, float scale)
+{
+    struct lbp_rect_geom *g = (struct lbp_rect_geom *)calloc(l->data.arena.num_classifiers, sizeof(struct lbp_rect_geom));
+    const struct lbp_arena_stage *s = l->data.arena.s;
+    int i, j;
+
+    for (i = 0; i < l->data.num_stages; i++, s = lbp_arena_next(s)) {
+        for (j = 0; j < s->num_weak_classifiers; j++) {
+            struct lbp_rect r;
+            r.x = lbp_arena_array(s, LBP_ARENA_RECT_X)[j];
+            r.y = lbp_arena_array(s, LBP_ARENA_RECT_Y)[j];
+            r.w = lbp_arena_array(s, LBP_ARENA_RECT_W)[j];
+            r.h = lbp_arena_array(s, LBP_ARENA_RECT_H)[j];
+            init_rect_geom(&g[s->first + j], &r, scale, l->width);
+        }
+    }
+    return g;
+}
+
+static void
+init_scales(struct lbp *l)
+{
+    float scale;
+    float scale_max = fminf((float)l->width / l->data.feature_width, (float)l->height / l->data.feature_height);
+    float scale_min = (float)l->para.min_face_width / l->data.feature_width;
+
+    if (l->para.max_face_width > 0)
+        scale_max = fminf(scale_max, (float)l->para.max_face_width / l->data.feature_width);
+    /* levels are never larger than the frame */
+    if (l->engine == FACE_ENGINE_PYRAMID && scale_min < 1)
+        scale_min = 1;
+
+    for (scale = scale_min; scale < scale_max; scale *= l->para.scaling_factor) {
+        struct lbp_scale s;
+        s.scale = scale;
+        s.g = init_geom_table(l, scale);
+        s.level_w = l->width / scale;
+        s.level_h = l->height / scale;
+        l->scales.push_back(s);
+    }
+}
+
+static void
+init_task_pyramid(struct lbp *l)
+{
+    int step_x = l->data.feature_width / l->para.step_scale_x;
+    int step_y = l->data.feature_height / l->para.step_scale_y;
+    unsigned int k;
+
+    for (k = 0; k < l->scales.size(); k++) {
+        const struct lbp_scale *s = &l->scales[k];
+        /* in level coordinates, one range per level */
+        add_range(l->ranges, 0, 0, step_x, step_y,
+                grid_count(0, step_x, l->data.feature_width, s->level_w - 1),
+                grid_count(0, step_y, l->data.feature_height, s->level_h - 1), s->scale, k);
+    }
+}
+
+static void
+init_task(struct lbp *l)
+{
+    unsigned int k;
+
+    if (l->engine == FACE_ENGINE_PYRAMID) {
+        init_task_pyramid(l);
+        l->num_tasks = ranges_windows(l->ranges);
+        return;
+    }
+    for (k = 0; k < l->scales.size(); k++) {
+        float scale = l->scales[k].scale;
+        float scaled_width = l->data.feature_width * scale;
+        float scaled_height = l->data.feature_height * scale;
+        int step_x = scaled_width / l->para.step_scale_x;
+        int step_y = scaled_height / l->para.step_scale_y;
+        /* bilinear lookups read one pixel past the window */
+        if (ceilf(scaled_width) + 1 > l->max_window_w)
+            l->max_window_w = ceilf(scaled_width) + 1;
+        if (ceilf(scaled_height) + 1 > l->max_window_h)
+            l->max_window_h = ceilf(scaled_height) + 1;
+        add_range(l->ranges, 0, 0, step_x, step_y,
+                grid_count(0, step_x, scaled_width, l->width - 1),
+                grid_count(0, step_y, scaled_height, l->height - 1), scale, k);
+    }
+    l->num_tasks = ranges_windows(l->ranges);
+}
+
+#ifndef USE_OPENCL
+/* frame integral image interpolated at (j * scale - 1, i * scale - 1) for j in [0, level_w],
+ * row and column -1 are zero, so differences are the frame area under level pixels */
+static void
+get_level_integral_row(const struct lbp *l, const unsigned int *img, float scale, int i, int level_w, double *dst)
+{
+    double y = i * scale - 1;
+    int y1 = floor(y);
+    double fy = y - y1;
+    const unsigned int *top = y1 >= 0 ? img + y1 * l->width : NULL;
+    const unsigned int *bottom = y1 + 1 < l->height ? img + (y1 + 1) * l->width : NULL;
+    int j;
+
+    for (j = 0; j <= level_w; j++) {
+        double x = j * scale - 1;
+        int x1 = floor(x);
+        double fx = x - x1;
+        double v0 = 0, v1 = 0;
+
+        if (x1 >= 0) {
+            v0 += top ? top[x1] * (1 - fy) : 0;
+            v0 += bottom ? bottom[x1] * fy : 0;
+        }
+        if (x1 + 1 < l->width) {
+            v1 += top ? top[x1 + 1] * (1 - fy) : 0;
+            v1 += bottom ? bottom[x1 + 1] * fy : 0;
+        }
+        dst[j] = v0 * (1 - fx) + v1 * fx;
+    }
+}
+
+/* area downscale the frame from its integral image, then integrate the level,
+ * called by every thread of the team */
+static void
+build_level(struct lbp *l, const struct lbp_scale *s, const unsigned int *img, int thread)
+{
+    double *top = l->level_rows + (size_t)thread * 2 * (l->width + 1);
+    double *bottom = top + l->width + 1;
+    double area = (double)s->scale * s->scale;
+    int i;
+
+    #pragma omp for
+    for (i = 0; i < s->level_h; i++) {
+        unsigned char *dst = l->level_img + i * s->level_w;
+        int j;
+
+        get_level_integral_row(l, img, s->scale, i, s->level_w, top);
+        get_level_integral_row(l, img, s->scale, i + 1, s->level_w, bottom);
+        for (j = 0; j < s->level_w; j++) {
+            double v = (bottom[j + 1] - bottom[j] - top[j + 1] + top[j]) / area;
+            dst[j] = v >= 255 ? 255 : (unsigned char)(v + 0.5);
+        }
+    }
+
+    face_detector_gen_integral_image_team(l->level_integral, l->width, l->level_img, s->level_w,
+            FACE_FORMAT_GRAY, s->level_w, s->level_h, NULL, 0);
+}
+
+/* ties keep the order of the ranges, std::stable_sort would allocate every frame */
+static bool
+range_scale_less(const struct lbp_range& a, const struct lbp_range& b)
+{
+    return a.scale_idx < b.scale_idx || (a.scale_idx == b.scale_idx && a.first < b.first);
+}
+
+/* groups the ranges by level and numbers their windows again */
+static void
+sort_ranges_by_level(std::vector<struct lbp_range>& ranges)
+{
+    unsigned int k, first = 0;
+
+    std::sort(ranges.begin(), ranges.end(), range_scale_less);
+    for (k = 0; k < ranges.size(); k++) {
+        ranges[k].first = first;
+        first += range_windows(&ranges[k]);
+    }
+}
+
+/* evaluator of the engine and para.stage_major */
+static void
+select_scan(struct lbp *l)
+{
+    switch (l->engine) {
+    case FACE_ENGINE_FIXED:
+        l->scan = l->para.stage_major ? lbp_eval_stage_major<lbp_classify_fixed> : lbp_eval_depth_first<lbp_classify_fixed>;
+        break;
+    case FACE_ENGINE_FIXED_DRIFT:
+        l->scan = NULL;
+        break;
+    default:
+        l->scan = l->para.stage_major ? pf_lbp_scan_batch : pf_lbp_scan_depth_first;
+        break;
+    }
+}
+
+/* FACE_ENGINE_PYRAMID, ranges are in level coordinates and grouped by level */
+static void
+scan_pyramid(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, const std::vector<struct lbp_range>& ranges, std::vector<struct lbp_rect>& rects)
+{
+    begin_scan(l);
+    /* the OpenMP default team can grow after create */
+    if (alloc_level_rows(l)) {
+        end_scan(l, rects);
+        return;
+    }
+
+    #pragma omp parallel num_threads(scan_threads(l))
+    {
+        struct face_eval_stats stats = {};
+        int thread = team_thread();
+        unsigned int begin, end;
+
+        /* the pyramid comes from the full frame integral image */
+        if (prepare)
+            prepare(priv, 0, 0, l->width, l->height);
+
+        for (begin = 0; begin < ranges.size(); begin = end) {
+            const struct lbp_scale *s = &l->scales[ranges[begin].scale_idx];
+            unsigned int *level = img;
+            int i, first, last;
+
+            for (end = begin; end < ranges.size() && ranges[end].scale_idx == ranges[begin].scale_idx; end++)
+                ;
+            first = ranges[begin].first;
+            last = ranges[end - 1].first + range_windows(&ranges[end - 1]);
+            if (first == last)
+                continue;
+            /* the unscaled level is the frame itself */
+            if (s->level_w != l->width || s->level_h != l->height) {
+                build_level(l, s, img, thread);
+                level = l->level_integral;
+            }
+
+            /* the implied barrier keeps the level until every window is done */
+            #pragma omp for
+            for (i = first; i < last; i++) {
+                struct lbp_task t;
+                int found;
+
+                get_tasks(&ranges[begin], end - begin, i, 1, &t);
+                found = lbp_eval_window<lbp_classify_integer>(&l->data, l->level_g, level + t.x + t.y * l->width, l->width, &stats);
+                stats.windows++;
+                if (found)
+                    add_lbp_object(l, thread, i, t.x * s->scale, t.y * s->scale, s->scale);
+            }
+        }
+        add_eval_stats(&l->threads[thread].stats, &stats);
+    }
+    end_scan(l, rects);
+}
+#endif
+
+/* a tracking parameter at a search level, from the full search to the predicted one */
+static inline float
+track_level_mix(float full, float predicted, int level)
+{
+    return full + (predicted - full) * level / (LBP_TRACK_LEVELS - 1);
+}
+
+/* search box of a face at a search level, clamped to the frame, returns true if it had to be */
+static bool
+get_search_box(const struct lbp *l, int x, int y, int w, int h, int level, int *min_x, int *min_y, int *max_x, int *max_y)
+{
+    float offset = track_level_mix(l->para.tracking_offset, l->para.tracking_predicted_offset, level);
+
+    *min_x = x - w * offset;
+    *min_y = y - h * offset;
+    *max_x = x + w * (1 + offset);
+    *max_y = y + h * (1 + offset);
+    if (*min_x >= 0 && *min_y >= 0 && *max_x <= l->width - 1 && *max_y <= l->height - 1)
+        return false;
+    if (*min_x < 0) *min_x = 0;
+    if (*min_y < 0) *min_y = 0;
+    if (*max_x > l->width - 1) *max_x = l->width - 1;
+    if (*max_y > l->height - 1) *max_y = l->height - 1;
+    return true;
+}
+
+static inline int
+align_up(int v, int step)
+{
+    return (v + step - 1) / step * step;
+}
+
+/* the search grid of the face box in e, the ranges keep their capacity. The windows are
+ * full scan windows, so the grids of faces close to each other share the ones in between */
+static void
+build_face_grid(struct lbp *l, struct lbp_track_face *e)
+{
+    float scale_max = (float)e->w / l->data.feature_width *
+        track_level_mix(l->para.tracking_scale_up, l->para.tracking_predicted_scale_up, e->level);
+    float scale_min = (float)e->w / l->data.feature_width *
+        track_level_mix(l->para.tracking_scale_down, l->para.tracking_predicted_scale_down, e->level);
+    int min_x, min_y, max_x, max_y;
+    unsigned int k;
+
+    e->clamped = get_search_box(l, e->x, e->y, e->w, e->h, e->level, &min_x, &min_y, &max_x, &max_y);
+    e->built_x = e->x;
+    e->built_y = e->y;
+    e->ranges.clear();
+    /* only the scales of the full scan have geometry tables */
+    for (k = 0; k < l->scales.size(); k++) {
+        int x, y;
+        float scale = l->scales[k].scale;
+        float scaled_width = l->data.feature_width * scale;
+        float scaled_height = l->data.feature_height * scale;
+        int step_x, step_y;
+        if (scale < scale_min || scale >= scale_max)
+            continue;
+        if (l->engine == FACE_ENGINE_PYRAMID) {
+            /* feature sized windows on the level */
+            int level_max_x = fminf(max_x / scale, l->scales[k].level_w - 1);
+            int level_max_y = fminf(max_y / scale, l->scales[k].level_h - 1);
+            step_x = l->data.feature_width / l->para.step_scale_x;
+            step_y = l->data.feature_height / l->para.step_scale_y;
+            x = align_up(ceilf(min_x / scale), step_x);
+            y = align_up(ceilf(min_y / scale), step_y);
+            add_range(e->ranges, x, y, step_x, step_y,
+                    grid_count(x, step_x, l->data.feature_width, level_max_x),
+                    grid_count(y, step_y, l->data.feature_height, level_max_y), scale, k);
+            continue;
+        }
+        step_x = scaled_width / l->para.step_scale_x;
+        step_y = scaled_height / l->para.step_scale_y;
+        x = align_up(min_x, step_x);
+        y = align_up(min_y, step_y);
+        add_range(e->ranges, x, y, step_x, step_y,
+                grid_count(x, step_x, scaled_width, max_x),
+                grid_count(y, step_y, scaled_height, max_y), scale, k);
+    }
+}
+
+/* true if the windows of r are inside the frame, or the level for the pyramid */
+static bool
+range_inside(const struct lbp *l, const struct lbp_range *r)
+{
+    float w = l->data.feature_width, h = l->data.feature_height;
+    int limit_x = l->width - 1, limit_y = l->height - 1;
+
+    if (l->engine == FACE_ENGINE_PYRAMID) {
+        limit_x = l->scales[r->scale_idx].level_w - 1;
+        limit_y = l->scales[r->scale_idx].level_h - 1;
+    } else {
+        w *= r->scale;
+        h *= r->scale;
+    }
+    return r->x >= 0 && r->y >= 0 &&
+        r->x + (r->grid_w - 1) * r->step_x + w < limit_x &&
+        r->y + (r->grid_h - 1) * r->step_y + h < limit_y;
+}
+
+/* grid steps of the nearest move to v from where the grid was built */
+static inline int
+steps_from_built(float v, float scale, int step)
+{
+    return lroundf(v / scale / step);
+}
+
+/* moves the grid of e along to the box (x, y) by whole grid steps, the nearest to the
+ * move from where it was built at every scale, so slow moves add up. Returns false,
+ * leaving e alone, if a window would leave the frame */
+static bool
+translate_face_grid(struct lbp *l, struct lbp_track_face *e, int x, int y)
+{
+    unsigned int k;
+    int pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (k = 0; k < e->ranges.size(); k++) {
+            struct lbp_range r = e->ranges[k];
+            /* pyramid grids are in level coordinates */
+            float scale = l->engine == FACE_ENGINE_PYRAMID ? r.scale : 1.0f;
+
+            if (!r.grid_w)
+                continue;
+            r.x += (steps_from_built(x - e->built_x, scale, r.step_x) -
+                    steps_from_built(e->x - e->built_x, scale, r.step_x)) * r.step_x;
+            r.y += (steps_from_built(y - e->built_y, scale, r.step_y) -
+                    steps_from_built(e->y - e->built_y, scale, r.step_y)) * r.step_y;
+            if (!pass && !range_inside(l, &r))
+                return false;
+            if (pass)
+                e->ranges[k] = r;
+        }
+    }
+    e->x = x;
+    e->y = y;
+    return true;
+}
+
+static inline int
+quantize(int v, int q)
+{
+    return (v + q / 2) / q * q;
+}
+
+/* index in track_faces of the cached search grid of face f at a search level. A grid of
+ * an earlier frame for the same box and level is reused as it is, then one whose size
+ * snaps to the same one is moved along, else the least recently used one is rebuilt.
+ * exact looks for the first only and returns -1 if there is none */
+static int
+get_face_grid(struct lbp *l, const struct face *f, int level, bool exact)
+{
+    int q = l->para.tracking_quantum;
+    int x = f->x, y = f->y;
+    int w = quantize(f->width, q), h = quantize(f->height, q);
+    struct lbp_track_face *e, *moved = NULL, *unused = NULL;
+    unsigned int k;
+
+    for (k = 0; k < l->track_faces.size(); k++) {
+        e = &l->track_faces[k];
+        if (e->frame == l->track_frame)
+            continue;
+        if (e->x == x && e->y == y && e->w == w && e->h == h && e->level == level) {
+            l->track_reused++;
+            e->frame = l->track_frame;
+            return k;
+        }
+        if (!moved && e->w == w && e->h == h && e->level == level && !e->clamped)
+            moved = e;
+        if (!unused || e->frame < unused->frame)
+            unused = e;
+    }
+    if (exact)
+        return -1;
+    if (moved) {
+        int min_x, min_y, max_x, max_y;
+
+        if (!get_search_box(l, x, y, w, h, level, &min_x, &min_y, &max_x, &max_y) &&
+            translate_face_grid(l, moved, x, y)) {
+            l->track_translated++;
+            moved->frame = l->track_frame;
+            return moved - &l->track_faces[0];
+        }
+    }
+    if (!unused) {
+        l->track_faces.push_back(lbp_track_face());
+        unused = &l->track_faces.back();
+    }
+    unused->x = x;
+    unused->y = y;
+    unused->w = w;
+    unused->h = h;
+    unused->level = level;
+    build_face_grid(l, unused);
+    l->track_built++;
+    unused->frame = l->track_frame;
+    return unused - &l->track_faces[0];
+}
+
+/* grows roi, x0, y0, x1, y1, to the part of the integral image the windows of r read */
+static void
+add_range_roi(const struct lbp *l, const struct lbp_range *r, int *roi)
+{
+    /* bilinear lookups read one pixel past the window */
+    int x1 = r->x + (r->grid_w - 1) * r->step_x + (int)ceilf(l->data.feature_width * r->scale) + 2;
+    int y1 = r->y + (r->grid_h - 1) * r->step_y + (int)ceilf(l->data.feature_height * r->scale) + 2;
+
+    if (!r->grid_w)
+        return;
+    if (r->x < roi[0]) roi[0] = r->x;
+    if (r->y < roi[1]) roi[1] = r->y;
+    if (x1 > roi[2]) roi[2] = std::min(x1, l->width);
+    if (y1 > roi[3]) roi[3] = std::min(y1, l->height);
+}
+
+static bool
+ranges_overlap(const struct lbp_range *a, const struct lbp_range *b)
+{
+    return a->x <= b->x + (b->grid_w - 1) * b->step_x && b->x <= a->x + (a->grid_w - 1) * a->step_x &&
+        a->y <= b->y + (b->grid_h - 1) * b->step_y && b->y <= a->y + (a->grid_h - 1) * a->step_y;
+}
+
+/* appends the union of the n overlapping grids at r, all of one scale and on the full scan
+ * lattice, to ranges. Columns with the same runs of windows make one range */
+static void
+add_merged_ranges(struct lbp *l, const struct lbp_range *r, int n, std::vector<struct lbp_range>& ranges)
+{
+    int step_x = r->step_x, step_y = r->step_y;
+    int x0 = r->x, y0 = r->y, cols = 0, rows = 0;
+    int i, c, start, gy;
+    unsigned char *mask;
+
+    for (i = 1; i < n; i++) {
+        x0 = std::min(x0, r[i].x);
+        y0 = std::min(y0, r[i].y);
+    }
+    for (i = 0; i < n; i++) {
+        cols = std::max(cols, (r[i].x - x0) / step_x + r[i].grid_w);
+        rows = std::max(rows, (r[i].y - y0) / step_y + r[i].grid_h);
+    }
+    /* column by column, the window order of a range */
+    l->merge_mask.assign(cols * rows, 0);
+    mask = &l->merge_mask[0];
+    for (i = 0; i < n; i++) {
+        int cx = (r[i].x - x0) / step_x, cy = (r[i].y - y0) / step_y;
+        for (c = cx; c < cx + r[i].grid_w; c++)
+            memset(mask + c * rows + cy, 1, r[i].grid_h);
+    }
+    for (start = 0, c = 1; c <= cols; c++) {
+        if (c < cols && !memcmp(mask + c * rows, mask + start * rows, rows))
+            continue;
+        for (gy = 0; gy < rows; gy++) {
+            int end;
+            if (!mask[start * rows + gy])
+                continue;
+            for (end = gy; end < rows && mask[start * rows + end]; end++)
+                ;
+            add_range(ranges, x0 + start * step_x, y0 + gy * step_y, step_x, step_y,
+                    c - start, end - gy, r->scale, r->scale_idx);
+            gy = end;
+        }
+        start = c;
+    }
+}
+
+/* merges the grids of every scale of ranges so no window is in two of them, they are
+ * renumbered scale by scale. Returns the windows left out */
+static unsigned int
+merge_ranges(struct lbp *l, std::vector<struct lbp_range>& ranges)
+{
+    std::vector<struct lbp_range>& src = l->merge_src;
+    unsigned int windows = ranges_windows(ranges), begin, end, i, j;
+
+    src.clear();
+    for (i = 0; i < ranges.size(); i++) {
+        if (ranges[i].grid_w)
+            src.push_back(ranges[i]);
+    }
+    std::sort(src.begin(), src.end(), range_scale_less);
+    ranges.clear();
+    for (begin = 0; begin < src.size(); begin = end) {
+        bool overlap = false;
+
+        for (end = begin; end < src.size() && src[end].scale_idx == src[begin].scale_idx; end++)
+            ;
+        for (i = begin; i < end && !overlap; i++) {
+            for (j = i + 1; j < end && !overlap; j++)
+                overlap = ranges_overlap(&src[i], &src[j]);
+        }
+        if (overlap) {
+            add_merged_ranges(l, &src[begin], end - begin, ranges);
+            continue;
+        }
+        for (i = begin; i < end; i++) {
+            add_range(ranges, src[i].x, src[i].y, src[i].step_x, src[i].step_y,
+                    src[i].grid_w, src[i].grid_h, src[i].scale, src[i].scale_idx);
+        }
+    }
+    return windows - ranges_windows(ranges);
+}
+
+/* the integral image a scan of ranges reads, as x0, y0, x1, y1 */
+static void
+get_ranges_roi(const struct lbp *l, const std::vector<struct lbp_range>& ranges, int *roi)
+{
+    unsigned int k;
+
+    roi[0] = l->width;
+    roi[1] = l->height;
+    roi[2] = 0;
+    roi[3] = 0;
+    /* the pyramid levels are built from the full frame */
+    if (l->engine == FACE_ENGINE_PYRAMID) {
+        roi[0] = roi[1] = 0;
+        roi[2] = l->width;
+        roi[3] = l->height;
+        return;
+    }
+    for (k = 0; k < ranges.size(); k++) {
+        add_range_roi(l, &ranges[k], roi);
+    }
+}
+
+/* the motion of face f, the one seen by the last tracking call, or lost by it and searched
+ * again, whose prediction is closest, within its full search box. A new one if there is none */
+static struct lbp_face_motion *
+get_face_motion(struct lbp *l, const struct face *f)
+{
+    float cx = f->x + f->width / 2.0f, cy = f->y + f->height / 2.0f;
+    struct lbp_face_motion *m, *found = NULL, *unused = NULL;
+    float best = 0;
+    unsigned int k;
+
+    for (k = 0; k < l->motions.size(); k++) {
+        m = &l->motions[k];
+        if (m->frame == l->track_frame) {
+            continue;
+        } else if (m->frame + 2 >= l->track_frame) {
+            float dx = cx - (m->px + m->pw / 2), dy = cy - (m->py + m->ph / 2);
+            float reach = m->pw * l->para.tracking_offset;
+            if (dx * dx + dy * dy <= reach * reach && (!found || dx * dx + dy * dy < best)) {
+                found = m;
+                best = dx * dx + dy * dy;
+            }
+        } else if (!unused || m->frame < unused->frame) {
+            unused = m;
+        }
+    }
+    if (found)
+        return found;
+    if (!unused) {
+        l->motions.push_back(lbp_face_motion());
+        unused = &l->motions.back();
+    }
+    unused->x = f->x;
+    unused->y = f->y;
+    unused->w = f->width;
+    unused->h = f->height;
+    unused->vx = unused->vy = unused->vw = 0;
+    unused->level = 0;
+    unused->moves = 0;
+    /* nothing was predicted, found where it was */
+    unused->px = f->x;
+    unused->py = f->y;
+    unused->pw = f->width;
+    unused->ph = f->height;
+    unused->frame = l->track_frame;
+    return unused;
+}
+
+static void
+add_predicted(struct lbp *l, const struct lbp_face_motion *m)
+{
+    struct face p;
+
+    p.x = lroundf(m->px);
+    p.y = lroundf(m->py);
+    p.width = lroundf(m->pw);
+    p.height = lroundf(m->ph);
+    l->predicted.push_back(p);
+    l->predicted_level.push_back(m->level);
+}
+
+/* para.tracking_predict, fills predicted with where the faces will be and the search level
+ * around them. The velocities are smoothed over the frames, a search narrows by a level
+ * each time the prediction held, within half its margin, and is back to the full box as
+ * soon as one did not. A face the last call lost is searched for once more, in the full
+ * box one more frame along */
+static void
+predict_faces(struct lbp *l, const struct face *fa, int faces)
+{
+    unsigned int k;
+    int i;
+
+    l->predicted.clear();
+    l->predicted_level.clear();
+    for (i = 0; i < faces; i++) {
+        const struct face *f = &fa[i];
+        struct lbp_face_motion *m = get_face_motion(l, f);
+
+        if (m->frame != l->track_frame) {
+            float margin = track_level_mix(l->para.tracking_offset, l->para.tracking_predicted_offset, m->level);
+            float scale_margin = 1 - track_level_mix(l->para.tracking_scale_down, l->para.tracking_predicted_scale_down, m->level);
+            float dx = f->x - m->px, dy = f->y - m->py, dw = f->width - m->pw;
+            bool held = sqrtf(dx * dx + dy * dy) <= m->pw * margin / 2 && fabsf(dw) <= m->pw * scale_margin / 2;
+            /* 2 frames since it was found if it was lost once */
+            float frames = l->track_frame - m->frame;
+            /* grouped boxes jitter by several pixels, but a velocity smoothed up from 0
+             * lags behind fast faces until they are lost */
+            float smooth = m->moves++ ? 4 : 1;
+
+            m->level = held ? std::min(m->level + 1, LBP_TRACK_LEVELS - 1) : 0;
+            m->vx += ((f->x - m->x) / frames - m->vx) / smooth;
+            m->vy += ((f->y - m->y) / frames - m->vy) / smooth;
+            m->vw += ((f->width - m->w) / frames - m->vw) / smooth;
+            m->x = f->x;
+            m->y = f->y;
+            m->w = f->width;
+            m->h = f->height;
+            m->frame = l->track_frame;
+        }
+        m->px = m->x + m->vx;
+        m->py = m->y + m->vy;
+        m->pw = std::max(m->w + m->vw, 1.0f);
+        m->ph = m->h * m->pw / m->w;
+        add_predicted(l, m);
+    }
+    for (k = 0; k < l->motions.size(); k++) {
+        struct lbp_face_motion *m = &l->motions[k];
+
+        if (m->frame + 1 != l->track_frame)
+            continue;
+        m->px += m->vx;
+        m->py += m->vy;
+        m->pw = std::max(m->pw + m->vw, 1.0f);
+        m->ph = m->h * m->pw / m->w;
+        m->level = 0;
+        add_predicted(l, m);
+    }
+}
+
+/* fills tracking_ranges with the search grids of the faces */
+static void
+get_tracking_ranges(struct lbp *l, const struct face *fa, int faces)
+{
+    std::vector<struct lbp_range>& ranges = l->tracking_ranges;
+    int i;
+
+    l->track_frame++;
+    ranges.clear();
+    if (l->para.tracking_predict) {
+        predict_faces(l, fa, faces);
+        faces = l->predicted.size();
+        fa = faces ? &l->predicted[0] : NULL;
+    } else {
+        l->predicted_level.assign(faces, 0);
+    }
+    /* faces that stayed put get their own grid back before any is moved or rebuilt */
+    l->track_face_idx.resize(faces);
+    for (i = 0; i < faces; i++) {
+        l->track_face_idx[i] = get_face_grid(l, &fa[i], l->predicted_level[i], true);
+    }
+    for (i = 0; i < faces; i++) {
+        if (l->track_face_idx[i] < 0)
+            l->track_face_idx[i] = get_face_grid(l, &fa[i], l->predicted_level[i], false);
+    }
+    for (i = 0;i < faces; i++) {
+        const struct lbp_track_face *e = &l->track_faces[l->track_face_idx[i]];
+        unsigned int k;
+
+        for (k = 0; k < e->ranges.size(); k++) {
+            const struct lbp_range *r = &e->ranges[k];
+            add_range(ranges, r->x, r->y, r->step_x, r->step_y, r->grid_w, r->grid_h, r->scale, r->scale_idx);
+        }
+    }
+    ALOGD("Tracking grids: %lu reused, %lu moved, %lu built", l->track_reused, l->track_translated, l->track_built);
+}
+
+/* scans tracking_ranges, the hits go to detected_r */
+static void
+scan_tracking_ranges(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, const int *roi)
+{
+    std::vector<struct lbp_range>& ranges = l->tracking_ranges;
+
+#ifdef USE_OPENCL
+    /* the kernel is built for the full frame */
+    if (prepare)
+        prepare(priv, 0, 0, l->width, l->height);
+    lbp_cl_tracking(l->cl, img, &ranges, l->detected_r);
+#else
+    if (l->engine == FACE_ENGINE_PYRAMID) {
+        sort_ranges_by_level(ranges);
+        scan_pyramid(l, img, prepare, priv, ranges, l->detected_r);
+        return;
+    }
+
+    /* the integral image has its origin at the top left of the region */
+    begin_scan(l);
+    if (roi[2] <= roi[0])
+        scan_ranges(l, img, ranges, 0, 0, prepare, priv, 0, 0);
+    else
+        scan_ranges(l, img, ranges, roi[0], roi[1], prepare, priv, roi[2] - roi[0], roi[3] - roi[1]);
+    end_scan(l, l->detected_r);
+#endif
+}
+
+int
+face_detector_lbp_tracking(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, struct face *fa, int faces, int *maxfaces)
+{
+    unsigned int merged;
+    int roi[4];
+
+    // create a subset of tasks based on previous detected face
+    get_tracking_ranges(l, fa, faces);
+    /* nearby faces search the same windows */
+    merged = merge_ranges(l, l->tracking_ranges);
+    l->stats.tracking_merged += merged;
+    get_ranges_roi(l, l->tracking_ranges, roi);
+    scan_tracking_ranges(l, img, prepare, priv, roi);
+    ALOGD("Tracking LBP tested: %u, %u merged", ranges_windows(l->tracking_ranges), merged);
+
+    return face_detector_lbp_group(l, l->detected_r, fa, maxfaces);
+}
+
+/* appends windows begin to end - 1 of the full scan to ranges, each scale's share as
+ * a partial column, whole columns and a partial column */
+static void
+add_full_scan_slice(struct lbp *l, std::vector<struct lbp_range>& ranges, unsigned int begin, unsigned int end)
+{
+    unsigned int k;
+
+    for (k = 0; k < l->ranges.size(); k++) {
+        const struct lbp_range *r = &l->ranges[k];
+        unsigned int b, e, n;
+
+        if (!r->grid_w || r->first + range_windows(r) <= begin || r->first >= end)
+            continue;
+        b = std::max(begin, r->first) - r->first;
+        e = std::min(end, r->first + range_windows(r)) - r->first;
+        while (b < e) {
+            int gx = b / r->grid_h, gy = b % r->grid_h;
+
+            if (gy || e - b < (unsigned int)r->grid_h) {
+                n = std::min(r->grid_h - gy, (int)(e - b));
+                add_range(ranges, r->x + gx * r->step_x, r->y + gy * r->step_y, r->step_x, r->step_y,
+                        1, n, r->scale, r->scale_idx);
+                b += n;
+            } else {
+                n = (e - b) / r->grid_h;
+                add_range(ranges, r->x + gx * r->step_x, r->y, r->step_x, r->step_y,
+                        n, r->grid_h, r->scale, r->scale_idx);
+                b += n * r->grid_h;
+            }
+        }
+    }
+}
+
+int
+face_detector_lbp_process(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, struct face *fa, int faces, int *maxfaces)
+{
+    unsigned int slices = l->para.scan_slices, begin, end, merged;
+    int roi[4];
+
+    if (slices <= 1)
+        return face_detector_lbp_detect(l, img, prepare, priv, fa, maxfaces);
+
+    begin = (unsigned long long)l->num_tasks * l->slice / slices;
+    end = (unsigned long long)l->num_tasks * (l->slice + 1) / slices;
+    l->slice = (l->slice + 1) % slices;
+
+    get_tracking_ranges(l, fa, faces);
+    add_full_scan_slice(l, l->tracking_ranges, begin, end);
+    /* the search grids are full scan windows, the slice may have some of them */
+    merged = merge_ranges(l, l->tracking_ranges);
+    l->stats.tracking_merged += merged;
+    get_ranges_roi(l, l->tracking_ranges, roi);
+    scan_tracking_ranges(l, img, prepare, priv, roi);
+    ALOGD("Process frame: full scan windows %u to %u and tracking, %u windows merged",
+            begin, end, merged);
+
+    return face_detector_lbp_group(l, l->detected_r, fa, maxfaces);
+}
+
+/* cuts the full scan into blocks of windows whose integral image footprint is about
+ * block_bytes, blocks of one scale go row by row so the next block reads the same rows */
+static void
+init_blocks(struct lbp *l)
+{
+    int side = sqrt(l->para.block_bytes / sizeof(unsigned int));
+    unsigned int k;
+    int bx, by;
+
+    l->blocks.clear();
+    if (!l->para.block_bytes)
+        return;
+    for (k = 0; k < l->ranges.size(); k++) {
+        const struct lbp_range *r = &l->ranges[k];
+        /* bilinear lookups read one pixel past the window */
+        int window_w = ceilf(l->data.feature_width * r->scale) + 1;
+        int window_h = ceilf(l->data.feature_height * r->scale) + 1;
+        int block_w, block_h;
+
+        if (!r->grid_w)
+            continue;
+        block_w = std::max(1, std::min(r->grid_w, (side - window_w) / r->step_x + 1));
+        block_h = std::max(1, std::min(r->grid_h, (side - window_h) / r->step_y + 1));
+        /* windows larger than the block read a few lines each anyway, a tile of them
+         * keeps the evaluators busy */
+        if (block_w * block_h < l->para.tile_windows) {
+            block_h = std::min(r->grid_h, (l->para.tile_windows + block_w - 1) / block_w);
+            block_w = std::min(r->grid_w, (l->para.tile_windows + block_h - 1) / block_h);
+        }
+        for (by = 0; by < r->grid_h; by += block_h) {
+            for (bx = 0; bx < r->grid_w; bx += block_w) {
+                add_range(l->blocks, r->x + bx * r->step_x, r->y + by * r->step_y, r->step_x, r->step_y,
+                        std::min(block_w, r->grid_w - bx), std::min(block_h, r->grid_h - by), r->scale, k);
+            }
+        }
+    }
+    ALOGD("Block scan: %ld blocks of about %zu bytes", l->blocks.size(), l->para.block_bytes);
+}
+
+/* every coarse_step-th window of every scale */
+static void
+init_coarse_tasks(struct lbp *l)
+{
+    int step = l->para.coarse_step;
+    unsigned int k;
+
+    l->coarse_ranges.clear();
+    l->num_coarse = 0;
+    if (step <= 1)
+        return;
+    for (k = 0; k < l->ranges.size(); k++) {
+        const struct lbp_range *r = &l->ranges[k];
+        add_range(l->coarse_ranges, r->x, r->y, r->step_x * step, r->step_y * step,
+                (r->grid_w + step - 1) / step, (r->grid_h + step - 1) / step, r->scale, r->scale_idx);
+    }
+    l->num_coarse = ranges_windows(l->coarse_ranges);
+    l->refine.assign(l->num_tasks, 0);
+}
+
+/* full scan, the coarse windows go through refine_stage stages and only the windows
+ * around the ones that get through are scanned to the end */
+static void
+scan_coarse_to_fine(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, std::vector<struct lbp_rect>& rects)
+{
+    struct lbp_data coarse = l->data;
+    struct coarse_tiles c = { &coarse, img };
+    unsigned int k, i;
+    int gx, gy;
+
+    coarse.num_stages = std::min(l->para.refine_stage, l->data.num_stages);
+    begin_scan(l);
+
+    run_scan(l, (l->num_coarse + l->para.tile_windows - 1) / l->para.tile_windows, scan_coarse_tile, &c,
+            prepare, priv, 0, 0, l->width, l->height);
+
+    /* in full scan order, still grouped by scale */
+    l->refined_tasks.clear();
+    for (k = 0, i = 0; k < l->ranges.size(); k++) {
+        const struct lbp_range *r = &l->ranges[k];
+        for (gx = 0; gx < r->grid_w; gx++) {
+            for (gy = 0; gy < r->grid_h; gy++, i++) {
+                struct lbp_task t;
+                if (!l->refine[i])
+                    continue;
+                t.x = r->x + gx * r->step_x;
+                t.y = r->y + gy * r->step_y;
+                t.scale = r->scale;
+                t.scale_idx = r->scale_idx;
+                l->refined_tasks.push_back(t);
+                l->refine[i] = 0;
+            }
+        }
+    }
+
+    scan_tiles(l, img, l->refined_tasks.empty() ? NULL : &l->refined_tasks[0], l->refined_tasks.size(), 0, 0,
+            NULL, NULL, l->width, l->height);
+    end_scan(l, rects);
+    ALOGD("LBP tested: %u coarse, %ld refined", l->num_coarse, l->refined_tasks.size());
+}
+
+int
+face_detector_lbp_detect_raw(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, std::vector<struct lbp_rect>& rects)
+{
+#ifdef USE_OPENCL
+    if (prepare)
+        prepare(priv, 0, 0, l->width, l->height);
+    lbp_cl_detect(l->cl, img, rects);
+#else
+    int width;
+    width = l->width;
+
+    if (l->engine == FACE_ENGINE_PYRAMID) {
+        scan_pyramid(l, img, prepare, priv, l->ranges, rects);
+        ALOGD("LBP tested: %u", l->num_tasks);
+        return 0;
+    }
+    if (l->num_coarse) {
+        scan_coarse_to_fine(l, img, prepare, priv, rects);
+        return 0;
+    }
+
+    begin_scan(l);
+    if (!l->blocks.empty()) {
+        run_scan(l, l->blocks.size(), scan_block, img, prepare, priv, 0, 0, width, l->height);
+    } else {
+        scan_ranges(l, img, l->ranges, 0, 0,
+                prepare, priv, width, l->height);
+    }
+    end_scan(l, rects);
+#endif
+    ALOGD("LBP tested: %u", l->num_tasks);
+
+    return 0;
+}
+
+int
+face_detector_lbp_detect_tile(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv,
+        int origin_x, int origin_y, std::vector<struct lbp_rect>& rects)
+{
+#ifdef USE_OPENCL
+    return face_detector_lbp_detect_raw(l, img, prepare, priv, rects);
+#else
+    unsigned int k;
+
+    /* levels are not on the frame grid */
+    if (l->engine == FACE_ENGINE_PYRAMID)
+        return face_detector_lbp_detect_raw(l, img, prepare, priv, rects);
+
+    l->tile_ranges.clear();
+    for (k = 0; k < l->ranges.size(); k++) {
+        const struct lbp_range *r = &l->ranges[k];
+        /* the first windows of the image grid in the tile */
+        int x = (r->step_x - origin_x % r->step_x) % r->step_x;
+        int y = (r->step_y - origin_y % r->step_y) % r->step_y;
+
+        add_range(l->tile_ranges, x, y, r->step_x, r->step_y,
+                grid_count(x, r->step_x, l->data.feature_width * r->scale, l->width - 1),
+                grid_count(y, r->step_y, l->data.feature_height * r->scale, l->height - 1),
+                r->scale, r->scale_idx);
+    }
+    begin_scan(l);
+    scan_ranges(l, img, l->tile_ranges, 0, 0, prepare, priv, l->width, l->height);
+    end_scan(l, rects);
+    return 0;
+#endif
+}
+
+int
+face_detector_lbp_group(struct lbp *l, std::vector<struct lbp_rect>& rects, struct face *fa, int *maxfaces)
+{
+    int i;
+
+    /* merge overlapped rectangles */
+    face_detector_group_rectangle(rects, l->para.group_threshold, l->para.eps);
+
+    /* return faces detected after merging */
+    if (rects.size() > (unsigned int)*maxfaces) {
+        ALOGW("User provided maxface size not large enough");
+    } else {
+        *maxfaces = rects.size();
+    }
+
+    for (i = 0; i < *maxfaces; i++) {
+        fa[i].x = rects[i].x;
+        fa[i].y = rects[i].y;
+        fa[i].width = rects[i].w;
+        fa[i].height = rects[i].h;
+        fa[i].confidence_level = 50; /* TODO */
+    }
+    rects.clear();
+
+    return 0;
+}
+
+/* scans the windows of scale k of the full scan, their hits are appended to rects */
+static void
+scan_scale(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, unsigned int k, std::vector<struct lbp_rect>& rects)
+{
+    l->scale_range.assign(1, l->ranges[k]);
+    l->scale_range[0].first = 0;
+#ifdef USE_OPENCL
+    if (prepare)
+        prepare(priv, 0, 0, l->width, l->height);
+    lbp_cl_tracking(l->cl, img, &l->scale_range, rects);
+#else
+    if (l->engine == FACE_ENGINE_PYRAMID) {
+        scan_pyramid(l, img, prepare, priv, l->scale_range, rects);
+        return;
+    }
+    begin_scan(l);
+    scan_ranges(l, img, l->scale_range, 0, 0, prepare, priv, l->width, l->height);
+    end_scan(l, rects);
+#endif
+}
+
+/* frame pixels [x0, x1) x [y0, y1) added up */
+static inline unsigned int
+get_area_sum(const unsigned int *img, int width, int x0, int y0, int x1, int y1)
+{
+    unsigned int a = (x0 && y0) ? img[(y0 - 1) * width + x0 - 1] : 0;
+    unsigned int b = y0 ? img[(y0 - 1) * width + x1 - 1] : 0;
+    unsigned int c = x0 ? img[(y1 - 1) * width + x0 - 1] : 0;
+
+    return img[(y1 - 1) * width + x1 - 1] - b - c + a;
+}
+
+/* compares the block sums of the frame with the ones the block had when it last changed,
+ * a block whose mean moved by more than motion_threshold since has changed. Only those
+ * take the sums of the frame, so changes too slow to show from one frame to the next
+ * still add up until they do */
+static void
+get_changed_blocks(struct lbp *l, const unsigned int *img)
+{
+    int size = l->para.motion_block;
+    int bw = (l->width + size - 1) / size, bh = (l->height + size - 1) / size;
+    unsigned int *c;
+    int bx, by;
+
+    l->block_sums.resize(bw * bh);
+    l->changed_blocks.assign((bw + 1) * (bh + 1), 0);
+    c = &l->changed_blocks[0];
+    for (by = 0; by < bh; by++) {
+        int y0 = by * size, y1 = std::min(y0 + size, l->height);
+        for (bx = 0; bx < bw; bx++) {
+            int x0 = bx * size, x1 = std::min(x0 + size, l->width);
+            unsigned int sum = get_area_sum(img, l->width, x0, y0, x1, y1);
+            unsigned int *prev = &l->block_sums[by * bw + bx];
+            long diff = (long)sum - (long)*prev;
+            int changed = !l->motion_valid || labs(diff) > (long)l->para.motion_threshold * (x1 - x0) * (y1 - y0);
+
+            if (changed)
+                *prev = sum;
+            c[(by + 1) * (bw + 1) + bx + 1] = changed + c[by * (bw + 1) + bx + 1] +
+                    c[(by + 1) * (bw + 1) + bx] - c[by * (bw + 1) + bx];
+        }
+    }
+}
+
+/* true if the window at (x, y), w x h pixels with what the bilinear lookups read, is
+ * over a changed block */
+static bool
+window_changed(const struct lbp *l, int x, int y, int w, int h)
+{
+    int size = l->para.motion_block;
+    int bw = (l->width + size - 1) / size, bh = (l->height + size - 1) / size;
+    int bx0 = x / size, by0 = y / size;
+    int bx1 = std::min((x + w - 1) / size, bw - 1) + 1;
+    int by1 = std::min((y + h - 1) / size, bh - 1) + 1;
+    const unsigned int *c = &l->changed_blocks[0];
+
+    return c[by1 * (bw + 1) + bx1] - c[by0 * (bw + 1) + bx1] - c[by1 * (bw + 1) + bx0] + c[by0 * (bw + 1) + bx0];
+}
 
-static inline unsigned int
-get_value_bilinear(unsigned int *img, float x, float y, int width)
+/* dense full scan of the windows over blocks that changed since the last gated frame,
+ * the others are hits again if they were then */
+static void
+scan_motion_gated(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, std::vector<struct lbp_rect>& rects)
 {
-    unsigned int pt[4];
-    unsigned int *p = img + (int)x + (int)y * width;
-    double x1, x2;
-    double y1, y2;
+    unsigned int k, i, reused = 0;
+    int gx, gy;
 
-    pt[0] = *p;
-    pt[1] = *(p+1);
-    pt[2] = *(p+width);
-    pt[3] = *(p+width+1);
+    begin_scan(l);
+    /* the integral image first, its block sums decide what is scanned */
+    run_scan(l, 0, scan_tile, NULL, prepare, priv, 0, 0, l->width, l->height);
+    get_changed_blocks(l, img);
+    if (!l->motion_valid)
+        l->verdicts.assign(l->num_tasks, 0);
+    l->motion_valid = true;
 
-    x1 = floorf(x);
-    x2 = x1 + 1; 
-    y1 = floorf(y);
-    y2 = y1 + 1; 
+    l->motion_tasks.clear();
+    l->motion_task_idx.clear();
+    for (k = 0, i = 0; k < l->ranges.size(); k++) {
+        const struct lbp_range *r = &l->ranges[k];
+        /* bilinear lookups read one pixel past the window */
+        int w = ceilf(l->data.feature_width * r->scale) + 1;
+        int h = ceilf(l->data.feature_height * r->scale) + 1;
+
+        for (gx = 0; gx < r->grid_w; gx++) {
+            for (gy = 0; gy < r->grid_h; gy++, i++) {
+                struct lbp_task t;
+                t.x = r->x + gx * r->step_x;
+                t.y = r->y + gy * r->step_y;
+                t.scale = r->scale;
+                t.scale_idx = r->scale_idx;
+                if (window_changed(l, t.x, t.y, w, h)) {
+                    l->motion_tasks.push_back(t);
+                    l->motion_task_idx.push_back(i);
+                } else if (l->verdicts[i]) {
+                    add_lbp_object(l, 0, i, t.x, t.y, t.scale);
+                    reused++;
+                }
+            }
+        }
+    }
 
-    return (unsigned int)(pt[0] * (x2 - x) * (y2 - y) +
-               pt[1] * (x - x1) * (y2 - y) +
-               pt[2] * (x2 - x) * (y - y1) +
-               pt[3] * (x - x1) * (y - y1));
+    if (!l->motion_tasks.empty()) {
+        struct scan_tiles s = { img, &l->motion_tasks[0], &l->motion_task_idx[0], NULL, 0,
+                (int)l->motion_tasks.size(), 0, 0 };
+        run_scan(l, (s.n + l->para.tile_windows - 1) / l->para.tile_windows, scan_tile, &s,
+                NULL, NULL, 0, 0, l->width, l->height);
+    }
+    for (i = 0; i < l->motion_task_idx.size(); i++) {
+        l->verdicts[l->motion_task_idx[i]] = 0;
+    }
+    end_scan(l, rects);
+    for (i = 0; i < l->merged_hits.size(); i++) {
+        l->verdicts[l->merged_hits[i].task] = 1;
+    }
+    ALOGD("Motion gate: %ld of %u windows scanned, %u hits reused",
+            l->motion_tasks.size(), l->num_tasks, reused);
 }
 
-static void
-get_interpolated_integral_value(struct lbp_rect *r, unsigned int *img, int x, int y, int width, float scale, unsigned int *p)
+/* true once the faces grouped from the hits so far meet stop_faces or stop_width */
+static bool
+found_enough(struct lbp *l)
 {
-    /*  0  1  2  3
-     *  4  5  6  7
-     *  8  9 10 11
-     * 12 13 14 15
-     */
-    unsigned int i[16];
-    float fx, fy;
+    unsigned int i;
 
-    fx = (float)x + r->x * scale;
-    fy = (float)y + r->y * scale;
+    l->grouped = l->detected_r;
+    face_detector_group_rectangle(l->grouped, l->para.group_threshold, l->para.eps);
+    if (l->para.stop_faces && l->grouped.size() >= (unsigned int)l->para.stop_faces)
+        return true;
+    for (i = 0; l->para.stop_width && i < l->grouped.size(); i++) {
+        if (l->grouped[i].w >= l->para.stop_width)
+            return true;
+    }
+    return false;
+}
 
-    i[0] = get_value_bilinear(img, fx,                  fy, width);
-    i[1] = get_value_bilinear(img, fx + r->w*scale,     fy, width);
-    i[2] = get_value_bilinear(img, fx + r->w*scale * 2, fy, width);
-    i[3] = get_value_bilinear(img, fx + r->w*scale * 3, fy, width);
+/* full scan from the largest scale down, stops at the first scale that finds enough */
+static void
+detect_largest_first(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv)
+{
+    int k;
 
-    i[4] = get_value_bilinear(img, fx,                  fy + r->h*scale, width);
-    i[5] = get_value_bilinear(img, fx + r->w*scale,     fy + r->h*scale, width);
-    i[6] = get_value_bilinear(img, fx + r->w*scale * 2, fy + r->h*scale, width);
-    i[7] = get_value_bilinear(img, fx + r->w*scale * 3, fy + r->h*scale, width);
+    for (k = l->ranges.size() - 1; k >= 0; k--) {
+        if (!l->ranges[k].grid_w)
+            continue;
+        /* the integral image is built once, with the first scale */
+        scan_scale(l, img, prepare, priv, k, l->detected_r);
+        prepare = NULL;
+        if (found_enough(l))
+            break;
+    }
+    ALOGD("Largest first: stopped at scale %d of %ld", k < 0 ? 0 : k, l->ranges.size());
+}
 
-    i[8]  = get_value_bilinear(img, fx,                  fy + r->h*scale * 2, width);
-    i[9]  = get_value_bilinear(img, fx + r->w*scale,     fy + r->h*scale * 2, width);
-    i[10] = get_value_bilinear(img, fx + r->w*scale * 2, fy + r->h*scale * 2, width);
-    i[11] = get_value_bilinear(img, fx + r->w*scale * 3, fy + r->h*scale * 2, width);
+int
+face_detector_lbp_detect(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, struct face *fa, int *maxfaces)
+{
+    if (l->para.stop_faces || l->para.stop_width)
+        detect_largest_first(l, img, prepare, priv);
+    else if (l->para.motion_block)
+        scan_motion_gated(l, img, prepare, priv, l->detected_r);
+    else
+        face_detector_lbp_detect_raw(l, img, prepare, priv, l->detected_r);
 
-    i[12] = get_value_bilinear(img, fx,                  fy + r->h*scale * 3, width);
-    i[13] = get_value_bilinear(img, fx + r->w*scale,     fy + r->h*scale * 3, width);
-    i[14] = get_value_bilinear(img, fx + r->w*scale * 2, fy + r->h*scale * 3, width);
-    i[15] = get_value_bilinear(img, fx + r->w*scale * 3, fy + r->h*scale * 3, width);
+    return face_detector_lbp_group(l, l->detected_r, fa, maxfaces);
+}
 
-    p[0] = (i[0] - i[1] - i[4] + i[5]);
-    p[1] = (i[1] - i[2] - i[5] + i[6]);
-    p[2] = (i[2] - i[3] - i[6] + i[7]);
-    p[3] = (i[4] - i[5] - i[8] + i[9]);
-    p[4] = (i[5] - i[6] - i[9] + i[10]);
-    p[5] = (i[6] - i[7] - i[10] + i[11]);
-    p[6] = (i[8] - i[9] - i[12] + i[13]);
-    p[7] = (i[9] - i[10] - i[13] + i[14]);
-    p[8] = (i[10] - i[11] - i[14] + i[15]);
+void
+face_detector_lbp_max_window(struct lbp *l, int *width, int *height)
+{
+    *width = l->max_window_w;
+    *height = l->max_window_h;
 }
 
-static float
-lbp_classify(struct lbp_rect *r, struct weak_classifier *c, unsigned int *img, int x, int y, int width, int height, float scale)
+static void
+dump_stages_info(struct lbp *l)
 {
-    /* 0 1 2
-     * 3 4 5 
-     * 6 7 8
-     */
-    unsigned int p[9];
-    unsigned char lbp_code;
+    int i, total_weak_classifiers;
 
-    get_interpolated_integral_value(&r[c->rect_idx], img, x, y, width, scale, p);
+    ALOGD("Num Of stages: %d", l->data.num_stages);
 
-    lbp_code = 0;
-    if (p[0] >= p[4]) lbp_code |= 128;
-    if (p[1] >= p[4]) lbp_code |= 64;
-    if (p[2] >= p[4]) lbp_code |= 32;
-    if (p[3] >= p[4]) lbp_code |= 1;
-    if (p[5] >= p[4]) lbp_code |= 16;
-    if (p[6] >= p[4]) lbp_code |= 2;
-    if (p[7] >= p[4]) lbp_code |= 4;
-    if (p[8] >= p[4]) lbp_code |= 8;
+    total_weak_classifiers = 0;
 
-    if (c->lbpmap[lbp_code >> 5] & (1 << (lbp_code & 31))) {
-        return c->neg;
-    } else {
-        return c->pos;
+    for (i = 0; i < l->data.num_stages; i++) {
+        total_weak_classifiers += l->data.s[i].num_weak_classifiers;
     }
+
+    ALOGD("Total weak classifiers: %d", total_weak_classifiers);
 }
 
-static int
-lbp_detect(struct lbp *l, unsigned int *img, int x, int y, int width, int height, float scale)
+/* float rounded down or up of a double */
+static float
+float_below(double v)
 {
-    /* loop for all stages */
-    float threshold;
-    int i, j;
-    for (i = 0; i < l->data.num_stages; i++) {
-        /* loop all weak classifiers */
-        threshold = 0;
-        for (j = 0; j < l->data.s[i].num_weak_classifiers; j++) {
-            threshold += pf_lbp_classify(l->data.r, &l->data.s[i].classifiers[j], img, x, y, width, height, scale);
-        }
-        if (threshold < l->data.s[i].stage_threshold) {
-            /* not matched */
-            return 0;
-        }
-    }
-    /* here we pass all the stages and found a match */
-    return 1;
+    float f = v;
+    return f > v ? nextafterf(f, -INFINITY) : f;
 }
 
-static void
-add_lbp_object(struct lbp *l, int x, int y, float scale)
+static float
+float_above(double v)
 {
-    struct lbp_rect r;
-    r.x = x;
-    r.y = y;
-    r.w = l->data.feature_width * scale;
-    r.h = l->data.feature_height * scale;
-    l->detected_r.push_back(r);
+    float f = v;
+    return f < v ? nextafterf(f, INFINITY) : f;
 }
 
+/* reject/accept bounds of a stage, see struct lbp_arena. After j weak classifiers the
+ * rest adds at least min_rest and at most max_rest, the float sum of the n - j additions
+ * left is off by less than an ulp of the largest possible sum each. */
 static void
-init_task(struct lbp *l)
+init_stage_bounds(struct lbp_arena_stage *s, float *reject, float *accept, const float *pos, const float *neg)
 {
-    float scale;
-    float scale_max = fminf((float)l->width / l->data.feature_width, (float)l->height / l->data.feature_height);
-    float scale_min = (float)l->para.min_face_width / l->data.feature_width;
+    double max_rest = 0, min_rest = 0, largest = 0, error;
+    int j;
 
-    for (scale = scale_min; scale < scale_max; scale *= l->para.scaling_factor) {
-        int x, y;
-        float scaled_width = l->data.feature_width * scale;
-        float scaled_height = l->data.feature_height * scale;
-        int step_x = scaled_width / l->para.step_scale_x;
-        int step_y = scaled_height / l->para.step_scale_y;
-        for (x = 0; (x + scaled_width) < (l->width - 1); x += step_x) {
-            for (y = 0; (y + scaled_height) < (l->height - 1); y += step_y) {
-                struct lbp_task t;
-                t.x = x;
-                t.y = y;
-                t.scale = scale;
-                l->tasks.push_back(t);
-            }
-        }
+    for (j = 0; j < s->num_weak_classifiers; j++) {
+        largest += fmax(fabs(pos[j]), fabs(neg[j]));
+    }
+    for (j = s->num_weak_classifiers - 1; j >= 0; j--) {
+        max_rest += fmax(pos[j], neg[j]);
+        min_rest += fmin(pos[j], neg[j]);
+        error = (s->num_weak_classifiers - j) * ldexp(largest, -FLT_MANT_DIG + 1);
+        reject[j] = float_below(s->stage_threshold - max_rest - error);
+        accept[j] = float_above(s->stage_threshold - min_rest + error);
     }
 }
 
-int
-face_detector_lbp_tracking(struct lbp *l, unsigned int *img, struct face *fa, int faces, int *maxfaces)
+/* the partial sums every stage of the arena stops at, or bounds that never stop it */
+static void
+init_arena_bounds(struct lbp_data *data, int early_exit)
 {
-    // create a subset of tasks based on previous detected face
-    std::vector<struct lbp_task> tasks;
-    int i;
-    for (i = 0;i < faces; i++) {
-        float scale;
-        float scale_max = fminf((float)l->width / l->data.feature_width, (float)fa[i].width / l->data.feature_width * l->para.tracking_scale_up);
-        float scale_min = fmaxf((float)l->para.min_face_width / l->data.feature_width, (float)fa[i].width / l->data.feature_width * l->para.tracking_scale_down);
-        int min_x, min_y, max_x, max_y;
-        min_x = fa[i].x - fa[i].width * l->para.tracking_offset;
-        min_y = fa[i].y - fa[i].height * l->para.tracking_offset;
-        max_x = fa[i].x + fa[i].width * (1 + l->para.tracking_offset);
-        max_y = fa[i].y + fa[i].height * (1 + l->para.tracking_offset);
-
-        if (min_x < 0) min_x = 0;
-        if (min_y < 0) min_y = 0;
-        if (max_x > l->width - 1) max_x = l->width - 1;
-        if (max_y > l->height - 1) max_y = l->height - 1;
-        for (scale = scale_min; scale < scale_max; scale *= l->para.scaling_factor) {
-            int x, y;
-            float scaled_width = l->data.feature_width * scale;
-            float scaled_height = l->data.feature_height * scale;
-            int step_x, step_y;
-            step_x = scaled_width / l->para.step_scale_x;
-            step_y = scaled_height / l->para.step_scale_y;
-            for (x = min_x; (x + scaled_width) < max_x; x += step_x) {
-                for (y = min_y; (y + scaled_height) < max_y; y += step_y) {
-                    struct lbp_task t;
-                    t.x = x;
-                    t.y = y;
-                    t.scale = scale;
-                    tasks.push_back(t);
-                }
+    struct lbp_arena_stage *s = data->arena.s;
+    int i, j;
+
+    for (i = 0; i < data->num_stages; i++) {
+        int32_t *a = (int32_t *)(s + 1);
+        float *reject = (float *)(a + LBP_ARENA_REJECT * s->stride);
+        float *accept = (float *)(a + LBP_ARENA_ACCEPT * s->stride);
+
+        if (early_exit) {
+            init_stage_bounds(s, reject, accept, (float *)(a + LBP_ARENA_POS * s->stride),
+                    (float *)(a + LBP_ARENA_NEG * s->stride));
+        } else {
+            for (j = 0; j < s->num_weak_classifiers; j++) {
+                reject[j] = -INFINITY;
+                accept[j] = INFINITY;
             }
         }
-        
+        s = (struct lbp_arena_stage *)((int32_t *)s + s->next);
     }
-#ifdef USE_OPENCL
-    lbp_cl_tracking(l->cl, img, &tasks, l->detected_r);
-#else
-    int found;
-    int width, height;
-    width = l->width;
-    height = l->height;
+}
 
-    #pragma omp parallel for private(found)
-    for (i = 0; i < tasks.size(); i++) {
-        found = lbp_detect(l, img, tasks[i].x, tasks[i].y, width, height, tasks[i].scale);
-        if (found) {
-            #pragma omp critical
-            add_lbp_object(l, tasks[i].x, tasks[i].y, tasks[i].scale);
-        }
-    }
-    /* merge overlapped rectangles */
-    face_detector_group_rectangle(l->detected_r, l->para.group_threshold, l->para.eps);
-#endif
-    /* return faces detected after merging */
-    if (l->detected_r.size() > (unsigned int)*maxfaces) {
-        ALOGW("User provided maxface size not large enough");
-    } else {
-        *maxfaces = l->detected_r.size();
-    }
+/* packs the loaded cascade, see struct lbp_arena */
+static int
+init_arena(struct lbp_data *data, int early_exit)
+{
+    struct lbp_arena_stage *s;
+    size_t words = 0;
+    void *base;
+    int i, j, k, first = 0;
 
-    ALOGD("Tracking LBP tested: %ld", tasks.size());
-    
-    for (i = 0; i < *maxfaces; i++) {
-        fa[i].x = l->detected_r[i].x;
-        fa[i].y = l->detected_r[i].y;
-        fa[i].width = l->detected_r[i].w;
-        fa[i].height = l->detected_r[i].h;
-        fa[i].confidence_level = 50; /* TODO */
+    for (i = 0; i < data->num_stages; i++) {
+        int stride = (data->s[i].num_weak_classifiers + LBP_ARENA_LINE - 1) & ~(LBP_ARENA_LINE - 1);
+        words += LBP_ARENA_LINE + stride * LBP_ARENA_ARRAYS;
     }
-    l->detected_r.clear();
+    if (posix_memalign(&base, LBP_ARENA_ALIGN, words * sizeof(int32_t)))
+        return -ENOMEM;
+    memset(base, 0, words * sizeof(int32_t));
+    data->arena.s = (struct lbp_arena_stage *)base;
+    data->arena.size = words * sizeof(int32_t);
 
-    return 0;
-}
+    s = data->arena.s;
+    for (i = 0; i < data->num_stages; i++) {
+        const struct stage *src = &data->s[i];
+        int32_t *a;
+        float *pos, *neg;
 
-int
-face_detector_lbp_detect(struct lbp *l, unsigned int *img, struct face *fa, int *maxfaces)
-{
-    int i;
-#ifdef USE_OPENCL
-    lbp_cl_detect(l->cl, img, l->detected_r);
-#else
-    int found;
-    int width, height;
-    width = l->width;
-    height = l->height;
+        s->stage_threshold = src->stage_threshold;
+        s->num_weak_classifiers = src->num_weak_classifiers;
+        s->first = first;
+        s->stride = (src->num_weak_classifiers + LBP_ARENA_LINE - 1) & ~(LBP_ARENA_LINE - 1);
+        s->next = LBP_ARENA_LINE + s->stride * LBP_ARENA_ARRAYS;
+        a = (int32_t *)(s + 1);
+        pos = (float *)(a + LBP_ARENA_POS * s->stride);
+        neg = (float *)(a + LBP_ARENA_NEG * s->stride);
+        for (j = 0; j < src->num_weak_classifiers; j++) {
+            const struct weak_classifier *c = &src->classifiers[j];
+            const struct lbp_rect *r;
 
-    #pragma omp parallel for private(found)
-    for (i = 0; i < l->tasks.size(); i++) {
-        found = lbp_detect(l, img, l->tasks[i].x, l->tasks[i].y, width, height, l->tasks[i].scale);
-        if (found) {
-            #pragma omp critical
-            add_lbp_object(l, l->tasks[i].x, l->tasks[i].y, l->tasks[i].scale);
+            if (c->rect_idx < 0 || c->rect_idx >= data->num_rects) {
+                ALOGE("Stage %d classifier %d: rect %d out of range", i, j, c->rect_idx);
+                return -EINVAL;
+            }
+            r = &data->r[c->rect_idx];
+            pos[j] = c->pos;
+            neg[j] = c->neg;
+            for (k = 0; k < 8; k++) {
+                a[(LBP_ARENA_LBPMAP + k) * s->stride + j] = c->lbpmap[k];
+            }
+            a[LBP_ARENA_RECT_X * s->stride + j] = r->x;
+            a[LBP_ARENA_RECT_Y * s->stride + j] = r->y;
+            a[LBP_ARENA_RECT_W * s->stride + j] = r->w;
+            a[LBP_ARENA_RECT_H * s->stride + j] = r->h;
         }
+        first += src->num_weak_classifiers;
+        s = (struct lbp_arena_stage *)((int32_t *)s + s->next);
     }
-    /* merge overlapped rectangles */
-    face_detector_group_rectangle(l->detected_r, l->para.group_threshold, l->para.eps);
-#endif
-
-    /* return faces detected after merging */
-    if (l->detected_r.size() > (unsigned int)*maxfaces) {
-        ALOGW("User provided maxface size not large enough");
-    } else {
-        *maxfaces = l->detected_r.size();
-    }
+    data->arena.num_classifiers = first;
+    init_arena_bounds(data, early_exit);
 
-    ALOGD("LBP tested: %ld", l->tasks.size());
-    
-    for (i = 0; i < *maxfaces; i++) {
-        fa[i].x = l->detected_r[i].x;
-        fa[i].y = l->detected_r[i].y;
-        fa[i].width = l->detected_r[i].w;
-        fa[i].height = l->detected_r[i].h;
-        fa[i].confidence_level = 50; /* TODO */
-    }
-    l->detected_r.clear();
+    ALOGD("Cascade arena: %zu bytes", data->arena.size);
 
     return 0;
 }
 
-static void
-dump_stages_info(struct lbp *l)
+#ifdef LBP_BUILTIN_CASCADE
+static int
+load_lbp_data(struct lbp *l)
 {
-    int i, total_weak_classifiers;
-
-    ALOGD("Num Of stages: %d", l->data.num_stages);
-
-    total_weak_classifiers = 0;
+    int i;
 
+    l->data.feature_width = LBP_BUILTIN_FEATURE_WIDTH;
+    l->data.feature_height = LBP_BUILTIN_FEATURE_HEIGHT;
+    l->data.num_stages = LBP_BUILTIN_NUM_STAGES;
+    l->data.s = (struct stage *)calloc(l->data.num_stages, sizeof(struct stage));
     for (i = 0; i < l->data.num_stages; i++) {
-        total_weak_classifiers += l->data.s[i].num_weak_classifiers;
+        const struct lbp_builtin_stage_data *b = &lbp_builtin_stages[i];
+
+        l->data.s[i].stage_threshold = b->stage_threshold;
+        l->data.s[i].num_weak_classifiers = b->num_weak_classifiers;
+        l->data.s[i].classifiers = (struct weak_classifier *)malloc(b->num_weak_classifiers * sizeof(struct weak_classifier));
+        memcpy(l->data.s[i].classifiers, b->classifiers, b->num_weak_classifiers * sizeof(struct weak_classifier));
     }
+    l->data.num_rects = LBP_BUILTIN_NUM_RECTS;
+    l->data.r = (struct lbp_rect *)malloc(sizeof(lbp_builtin_rects));
+    memcpy(l->data.r, lbp_builtin_rects, sizeof(lbp_builtin_rects));
 
-    ALOGD("Total weak classifiers: %d", total_weak_classifiers);
-}
+    dump_stages_info(l);
 
+    return 0;
+}
+#else
 static int
 load_lbp_data(struct lbp *l)
 {
@@ -413,9 +2283,10 @@ load_lbp_data(struct lbp *l)
 
     return 0;
 }
+#endif
 
 struct lbp *
-face_detector_lbp_create(int width, int height, int minimum_face_width)
+face_detector_lbp_create(int width, int height, int minimum_face_width, int maximum_face_width, enum face_engine engine)
 {
     struct lbp *l;
     int ret;
@@ -428,20 +2299,68 @@ face_detector_lbp_create(int width, int height, int minimum_face_width)
     l->para.tracking_scale_down = 0.5;
     l->para.tracking_scale_up = 1.5;
     l->para.tracking_offset = 0.5;
+    l->para.tracking_quantum = 4;
+    l->para.tracking_predict = 0;
+    /* windows up to 1.5 times the face help the grouping, the box has to hold them */
+    l->para.tracking_predicted_offset = 0.25;
+    l->para.tracking_predicted_scale_down = 0.7;
+    l->para.tracking_predicted_scale_up = 1.5;
     l->para.group_threshold = 2;
     l->para.eps = 0.2;
     l->para.min_face_width = minimum_face_width;
+    l->para.max_face_width = maximum_face_width;
+    l->para.stage_major = 1;
+    l->para.tile_windows = 256;
+    l->para.early_exit = 1;
+    l->para.coarse_step = 1;
+    l->para.refine_stage = 2;
+    l->para.threads = 0;
+    l->para.block_bytes = 0;
+    l->para.stop_faces = 0;
+    l->para.stop_width = 0;
+    l->para.scan_slices = 1;
+    l->para.motion_block = 0;
+    l->para.motion_threshold = 2;
+#ifdef _OPENMP
+    l->para.thread_pool = 0;
+#else
+    /* the only way to run on more than one core */
+    l->para.thread_pool = 1;
+#endif
     l->width = width;
     l->height = height;
+#ifdef USE_OPENCL
+    if (engine != FACE_ENGINE_FLOAT) {
+        ALOGW("OpenCL always samples in float, engine %d ignored", engine);
+        engine = FACE_ENGINE_FLOAT;
+    }
+#endif
+    l->engine = engine;
+    select_scan(l);
 
     ret = load_lbp_data(l);
+    if (!ret)
+        ret = init_arena(&l->data, l->para.early_exit);
     if (ret) {
         face_detector_lbp_destroy(l);
         return NULL;
     }
+    init_scales(l);
     init_task(l);
+    if (engine == FACE_ENGINE_FLOAT || engine == FACE_ENGINE_FIXED)
+        init_coarse_tasks(l);
+    if (engine == FACE_ENGINE_PYRAMID) {
+        l->level_g = init_geom_table(l, 1.0f);
+        l->level_img = (unsigned char *)malloc(width * height);
+        l->level_integral = (unsigned int *)malloc(width * height * sizeof(unsigned int));
+        if (!l->level_img || !l->level_integral || alloc_level_rows(l)) {
+            ALOGE("Cannot allocate the pyramid levels");
+            face_detector_lbp_destroy(l);
+            return NULL;
+        }
+    }
 #ifdef USE_OPENCL
-    l->cl = lbp_cl_init(&l->data, &l->para, &l->tasks, width, height);
+    l->cl = lbp_cl_init(&l->data, &l->para, &l->ranges, width, height);
     if (l->cl == NULL) {
         face_detector_lbp_destroy(l);
         return NULL;
@@ -451,6 +2370,183 @@ face_detector_lbp_create(int width, int height, int minimum_face_width)
     return l;
 }
 
+int
+face_detector_lbp_threads(struct lbp *l, int threads)
+{
+    if (threads < 0)
+        return -EINVAL;
+    l->para.threads = threads;
+    return alloc_level_rows(l);
+}
+
+int
+face_detector_lbp_team_threads(struct lbp *l)
+{
+    return scan_threads(l);
+}
+
+int
+face_detector_lbp_thread_pool(struct lbp *l, int enable)
+{
+    l->para.thread_pool = enable;
+    return alloc_level_rows(l);
+}
+
+int
+face_detector_lbp_affinity(struct lbp *l, const int *cpus, int num_cpus)
+{
+    int i;
+
+    if (cpus && num_cpus <= 0)
+        return -EINVAL;
+    for (i = 0; cpus && i < num_cpus; i++) {
+        if (cpus[i] < 0)
+            return -EINVAL;
+    }
+    if (cpus)
+        l->cpus.assign(cpus, cpus + num_cpus);
+    else
+        l->cpus.clear();
+    if (l->pool)
+        return thread_pool_set_affinity(l->pool, cpus, num_cpus);
+    return 0;
+}
+
+int
+face_detector_lbp_block_scan(struct lbp *l, size_t block_bytes)
+{
+#ifdef USE_OPENCL
+    return -EINVAL;
+#else
+    if (l->engine == FACE_ENGINE_PYRAMID)
+        return -EINVAL;
+    if (block_bytes == LBP_BLOCK_L2) {
+        long l2 = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+        l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+        /* the other half for the cascade and the geometry tables */
+        block_bytes = (l2 > 0 ? l2 : 256 * 1024) / 2;
+    }
+    l->para.block_bytes = block_bytes;
+    init_blocks(l);
+    return 0;
+#endif
+}
+
+int
+face_detector_lbp_early_stop(struct lbp *l, int faces, int min_width)
+{
+    if (faces < 0 || min_width < 0)
+        return -EINVAL;
+    l->para.stop_faces = faces;
+    l->para.stop_width = min_width;
+    return 0;
+}
+
+int
+face_detector_lbp_stage_major(struct lbp *l, int enable)
+{
+#ifdef USE_OPENCL
+    return -EINVAL;
+#else
+    /* the drift and pyramid engines evaluate window by window */
+    if (l->engine != FACE_ENGINE_FLOAT && l->engine != FACE_ENGINE_FIXED)
+        return -EINVAL;
+    l->para.stage_major = !!enable;
+    select_scan(l);
+    return 0;
+#endif
+}
+
+int
+face_detector_lbp_early_exit(struct lbp *l, int enable)
+{
+#ifdef USE_OPENCL
+    /* the device has its own copy of the arena */
+    return -EINVAL;
+#else
+    l->para.early_exit = !!enable;
+    init_arena_bounds(&l->data, l->para.early_exit);
+    return 0;
+#endif
+}
+
+int
+face_detector_lbp_scan_slices(struct lbp *l, int slices)
+{
+    if (slices < 1)
+        return -EINVAL;
+    l->para.scan_slices = slices;
+    l->slice = 0;
+    return 0;
+}
+
+int
+face_detector_lbp_motion_gate(struct lbp *l, int block_size, int threshold)
+{
+#ifdef USE_OPENCL
+    return -EINVAL;
+#else
+    /* the pyramid scans levels, not frame windows */
+    if (block_size < 0 || threshold < 0 || l->engine == FACE_ENGINE_PYRAMID)
+        return -EINVAL;
+    l->para.motion_block = block_size;
+    l->para.motion_threshold = threshold;
+    /* the next gated frame scans everything */
+    l->motion_valid = false;
+    return 0;
+#endif
+}
+
+int
+face_detector_lbp_motion_prediction(struct lbp *l, int enable)
+{
+    l->para.tracking_predict = enable;
+    /* faces start again from the full search box */
+    l->motions.clear();
+    return 0;
+}
+
+int
+face_detector_lbp_coarse_scan(struct lbp *l, int coarse_step, int refine_stage)
+{
+#ifdef USE_OPENCL
+    return -EINVAL;
+#else
+    /* the drift and pyramid engines scan their own way */
+    if (coarse_step < 1 || refine_stage < 1 ||
+        (l->engine != FACE_ENGINE_FLOAT && l->engine != FACE_ENGINE_FIXED))
+        return -EINVAL;
+    l->para.coarse_step = coarse_step;
+    l->para.refine_stage = refine_stage;
+    init_coarse_tasks(l);
+    return 0;
+#endif
+}
+
+void
+face_detector_lbp_eval_stats(struct lbp *l, struct face_eval_stats *stats)
+{
+    *stats = l->stats;
+}
+
+/* the arena and the geometry table of one scale, what a scan of a scale reads */
+size_t
+face_detector_lbp_cascade_size(struct lbp *l)
+{
+    return l->data.arena.size + l->data.arena.num_classifiers * sizeof(struct lbp_rect_geom);
+}
+
+int
+face_detector_lbp_drift(struct lbp *l, struct face_drift *d)
+{
+    if (l->engine != FACE_ENGINE_FIXED_DRIFT)
+        return -EINVAL;
+    *d = l->drift;
+    return 0;
+}
+
 void
 face_detector_lbp_destroy(struct lbp *l)
 {
@@ -465,5 +2561,14 @@ face_detector_lbp_destroy(struct lbp *l)
     }
     free(l->data.s);
     free(l->data.r);
+    free(l->data.arena.s);
+    for (i = 0; i < (int)l->scales.size(); i++) {
+        free(l->scales[i].g);
+    }
+    free(l->level_g);
+    free(l->level_img);
+    free(l->level_integral);
+    free(l->level_rows);
+    thread_pool_destroy(l->pool);
     delete l;
 }
@@ -19,13 +19,71 @@
 #ifndef _LBP_DETECT_H
 #define _LBP_DETECT_H
 
+#include <vector>
 #include "face_object.h"
+#include "lbp.h"
 
 struct lbp;
 
-int face_detector_lbp_detect(struct lbp *l, unsigned int *img, struct face *fa, int *maxfaces);
-int face_detector_lbp_tracking(struct lbp *l, unsigned int *img, struct face *fa, int faces, int *maxfaces);
-struct lbp *face_detector_lbp_create(int width, int height, int minimum_face_width);
+/* called by every thread of the scan team before scanning, fills in img with the integral
+ * of the given frame region, its origin at img[0] and rows the frame width apart */
+typedef void (*lbp_prepare_t) (void *priv, int x, int y, int width, int height);
+
+int face_detector_lbp_detect(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, struct face *fa, int *maxfaces);
+/* full scan without merging, hits are appended to rects */
+int face_detector_lbp_detect_raw(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, std::vector<struct lbp_rect>& rects);
+/* dense full scan without merging of a tile whose top left is at (origin_x, origin_y)
+ * of a larger image, on the windows a scan of the whole image has, hits are appended to
+ * rects in tile coordinates */
+int face_detector_lbp_detect_tile(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv,
+        int origin_x, int origin_y, std::vector<struct lbp_rect>& rects);
+/* merges raw hits and copies them out, rects is cleared */
+int face_detector_lbp_group(struct lbp *l, std::vector<struct lbp_rect>& rects, struct face *fa, int *maxfaces);
+void face_detector_lbp_max_window(struct lbp *l, int *width, int *height);
+int face_detector_lbp_tracking(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, struct face *fa, int faces, int *maxfaces);
+/* tracks the faces and scans the next slice of the full scan, see lbp_para.scan_slices */
+int face_detector_lbp_process(struct lbp *l, unsigned int *img, lbp_prepare_t prepare, void *priv, struct face *fa, int faces, int *maxfaces);
+struct lbp *face_detector_lbp_create(int width, int height, int minimum_face_width, int maximum_face_width, enum face_engine engine);
+/* scan threads, 0 for the OpenMP default */
+int face_detector_lbp_threads(struct lbp *l, int threads);
+/* threads of the team that runs prepare, at most */
+int face_detector_lbp_team_threads(struct lbp *l);
+/* scan on the work stealing pool, pinned to cpus if not NULL */
+int face_detector_lbp_thread_pool(struct lbp *l, int enable);
+int face_detector_lbp_affinity(struct lbp *l, const int *cpus, int num_cpus);
+/* dense full scans in blocks of windows reading about block_bytes of the integral image,
+ * LBP_BLOCK_L2 for half the L2 cache, 0 scans column by column.
+ * -EINVAL for the pyramid engine and with OpenCL */
+#define LBP_BLOCK_L2 ((size_t)-1)
+int face_detector_lbp_block_scan(struct lbp *l, size_t block_bytes);
+/* full scans from the largest scale down, stopping once faces faces are grouped or one
+ * is at least min_width wide, see lbp_para. 0, 0 scans every scale */
+int face_detector_lbp_early_stop(struct lbp *l, int faces, int min_width);
+/* windows go through the cascade tile by tile stage by stage, 0 window by window, same
+ * results either way. -EINVAL for the drift and pyramid engines and with OpenCL */
+int face_detector_lbp_stage_major(struct lbp *l, int enable);
+/* stages stop once their outcome is certain, 0 sums every weak classifier, same
+ * results either way. -EINVAL with OpenCL */
+int face_detector_lbp_early_exit(struct lbp *l, int enable);
+/* tracking searches around where the faces are predicted to be, narrower while the
+ * predictions hold, see lbp_para */
+int face_detector_lbp_motion_prediction(struct lbp *l, int enable);
+/* slices of the full scan face_detector_lbp_process goes through, 1 scans all of it.
+ * -EINVAL if less than 1 */
+int face_detector_lbp_scan_slices(struct lbp *l, int slices);
+/* full scans keep the block sums of the frame and only scan the windows over blocks that
+ * changed, see lbp_para. block_size 0 scans every window.
+ * -EINVAL for the pyramid engine and with OpenCL */
+int face_detector_lbp_motion_gate(struct lbp *l, int block_size, int threshold);
+/* coarse to fine full scans, see lbp_para, coarse_step 1 scans every window.
+ * -EINVAL for the drift and pyramid engines and with OpenCL */
+int face_detector_lbp_coarse_scan(struct lbp *l, int coarse_step, int refine_stage);
+/* weak classifier work since create */
+void face_detector_lbp_eval_stats(struct lbp *l, struct face_eval_stats *stats);
+/* bytes of the packed cascade the evaluators read */
+size_t face_detector_lbp_cascade_size(struct lbp *l);
+/* returns -EINVAL unless created with FACE_ENGINE_FIXED_DRIFT */
+int face_detector_lbp_drift(struct lbp *l, struct face_drift *d);
 void face_detector_lbp_destroy(struct lbp *l);
 
 #endif
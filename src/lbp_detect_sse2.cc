@@ -19,85 +19,60 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <emmintrin.h>
+#if defined(CAN_COMPILE_AVX2) || defined(CAN_COMPILE_AVX512)
+#include <immintrin.h>
+#endif
 #include <math.h>
 #include "common.h"
+#include "cpu.h"
 #include "lbp.h"
+#include "lbp_eval.h"
 
 __attribute__((constructor)) static void lbp_detect_sse2_init( void );
 
-static inline unsigned int
-get_value_bilinear(unsigned int *img, float x, float y, int width, int height)
+static inline double
+get_value_bilinear(const unsigned int *d0, const unsigned int *d1, double ax, double bx, double ay, double by)
 {
-    unsigned int pt[4];
-    unsigned int *p = img + (int)x + (int)y * width;
-    double x1, x2;
-    double y1, y2;
-
-    pt[0] = *p;
-    pt[1] = *(p+1);
-    pt[2] = *(p+width);
-    pt[3] = *(p+width+1);
-
-    x1 = floorf(x);
-    x2 = x1 + 1; 
-    y1 = floorf(y);
-    y2 = y1 + 1; 
-
-    return (unsigned int)(pt[0] * (x2 - x) * (y2 - y) +
-               pt[1] * (x - x1) * (y2 - y) +
-               pt[2] * (x2 - x) * (y - y1) +
-               pt[3] * (x - x1) * (y - y1));
+    return (d0[0] * ax + d0[1] * bx) * ay + (d1[0] * ax + d1[1] * bx) * by;
 }
 
+/* same sampling as the plain c one in lbp_detect.cc, on box sums from the top left
+ * pixel read */
 static void
-get_interpolated_integral_value(struct lbp_rect *r, struct weak_classifier *c, unsigned int *img, int x, int y, int width, int height, float scale, unsigned int *p)
+get_interpolated_integral_value(const struct lbp_rect_geom *g, const unsigned int *img, int width, unsigned int *p)
 {
     /*  0  1  2  3
      *  4  5  6  7
      *  8  9 10 11
      * 12 13 14 15
      */
-    unsigned int i[16];
-    float fx[4], fy[4];
-
-    fx[0] = (float)x + r->x * scale;
-    fx[1] = fx[0] + r->w*scale;
-    fx[2] = fx[0] + r->w*scale*2;
-    fx[3] = fx[0] + r->w*scale*3;
-    fy[0] = (float)y + r->y * scale;
-    fy[1] = fy[0] + r->h*scale;
-    fy[2] = fy[0] + r->h*scale*2;
-    fy[3] = fy[0] + r->h*scale*3;
-
-    i[0] = get_value_bilinear(img, fx[0], fy[0], width, height);
-    i[1] = get_value_bilinear(img, fx[1], fy[0], width, height);
-    i[2] = get_value_bilinear(img, fx[2], fy[0], width, height);
-    i[3] = get_value_bilinear(img, fx[3], fy[0], width, height);
-
-    i[4] = get_value_bilinear(img, fx[0], fy[1], width, height);
-    i[5] = get_value_bilinear(img, fx[1], fy[1], width, height);
-    i[6] = get_value_bilinear(img, fx[2], fy[1], width, height);
-    i[7] = get_value_bilinear(img, fx[3], fy[1], width, height);
-
-    i[8]  = get_value_bilinear(img, fx[0], fy[2], width, height);
-    i[9]  = get_value_bilinear(img, fx[1], fy[2], width, height);
-    i[10] = get_value_bilinear(img, fx[2], fy[2], width, height);
-    i[11] = get_value_bilinear(img, fx[3], fy[2], width, height);
-
-    i[12] = get_value_bilinear(img, fx[0], fy[3], width, height);
-    i[13] = get_value_bilinear(img, fx[1], fy[3], width, height);
-    i[14] = get_value_bilinear(img, fx[2], fy[3], width, height);
-    i[15] = get_value_bilinear(img, fx[3], fy[3], width, height);
-
-    p[0] = (i[0] - i[1] - i[4] + i[5]);
-    p[1] = (i[1] - i[2] - i[5] + i[6]);
-    p[2] = (i[2] - i[3] - i[6] + i[7]);
-    p[3] = (i[4] - i[5] - i[8] + i[9]);
-    p[4] = (i[5] - i[6] - i[9] + i[10]);
-    p[5] = (i[6] - i[7] - i[10] + i[11]);
-    p[6] = (i[8] - i[9] - i[12] + i[13]);
-    p[7] = (i[9] - i[10] - i[13] + i[14]);
-    p[8] = (i[10] - i[11] - i[14] + i[15]);
+    const unsigned int *first = img + g->off_y[0];
+    unsigned int top[8], d[2][8];
+    double i[16];
+    int j, k, v;
+
+    for (j = 0; j < 8; j++)
+        top[j] = first[g->off_x[j / 2] + j % 2];
+    for (k = 0; k < 4; k++) {
+        for (v = 0; v < 2; v++) {
+            const unsigned int *row = img + g->off_y[k] + v * width;
+            unsigned int left = row[g->off_x[0]] - top[0];
+            for (j = 0; j < 8; j++)
+                d[v][j] = row[g->off_x[j / 2] + j % 2] - top[j] - left;
+        }
+        for (j = 0; j < 4; j++)
+            i[k * 4 + j] = get_value_bilinear(&d[0][j * 2], &d[1][j * 2], g->ax[j], g->bx[j], g->ay[k], g->by[k]);
+    }
+
+    p[0] = (int)(i[0] - i[1] - i[4] + i[5] + 0.5);
+    p[1] = (int)(i[1] - i[2] - i[5] + i[6] + 0.5);
+    p[2] = (int)(i[2] - i[3] - i[6] + i[7] + 0.5);
+    p[3] = (int)(i[4] - i[5] - i[8] + i[9] + 0.5);
+    p[4] = (int)(i[5] - i[6] - i[9] + i[10] + 0.5);
+    p[5] = (int)(i[6] - i[7] - i[10] + i[11] + 0.5);
+    p[6] = (int)(i[8] - i[9] - i[12] + i[13] + 0.5);
+    p[7] = (int)(i[9] - i[10] - i[13] + i[14] + 0.5);
+    p[8] = (int)(i[10] - i[11] - i[14] + i[15] + 0.5);
 }
 
 #define DECLARE_ASM_CONST(n,t,v)    static const t __attribute__((used)) __attribute__ ((aligned (n))) v
@@ -105,8 +80,8 @@ get_interpolated_integral_value(struct lbp_rect *r, struct weak_classifier *c, u
 DECLARE_ASM_CONST(16, uint8_t, lbp_weight)[] = {0x80, 0x40, 0x20, 0x1, 0, 0x10, 0x2, 0x4, 0x8, 0, 0, 0, 0, 0, 0, 0};
 DECLARE_ASM_CONST(16, uint32_t, sign)[] = {0x80000000, 0x80000000, 0x80000000, 0x80000000};
 
-static float
-lbp_classify_sse2(struct lbp_rect *r, struct weak_classifier *c, unsigned int *img, int x, int y, int width, int height, float scale)
+static inline int
+lbp_code_sse2(const struct lbp_rect_geom *g, const unsigned int *img, int width)
 {
     /* REVISIT performance almost same as plain c */
     /* 0 1 2
@@ -119,7 +94,7 @@ lbp_classify_sse2(struct lbp_rect *r, struct weak_classifier *c, unsigned int *i
         unsigned int p[9];
     } res;
 
-    get_interpolated_integral_value(&r[c->rect_idx], c, img, x, y, width, height, scale, res.p);
+    get_interpolated_integral_value(g, img, width, res.p);
 
     __asm__ volatile (
         /* xmm0 zero
@@ -129,6 +104,7 @@ lbp_classify_sse2(struct lbp_rect *r, struct weak_classifier *c, unsigned int *i
          * xmm4 sign
          * xmm5 center
          * xmm6 lbp_weight
+         * xmm7 scratch
          */
         "pxor %%xmm0,       %%xmm0       \n\t"
         "movdqa %[sign],    %%xmm4       \n\t"
@@ -145,18 +121,25 @@ lbp_classify_sse2(struct lbp_rect *r, struct weak_classifier *c, unsigned int *i
         "pxor %%xmm4,       %%xmm3       \n\t"
         "pxor %%xmm4,       %%xmm5       \n\t"
 
-        /* Suppose to be greater than or equal, but sse2 only support greater than */
-        "pcmpgtd %%xmm5,    %%xmm1       \n\t"
-        "pcmpgtd %%xmm5,    %%xmm2       \n\t"
-        "pcmpgtd %%xmm5,    %%xmm3       \n\t"
+        /* greater than or equal like the plain c, sse2 only has greater than,
+         * so compute center > p and take the bits where it is not set */
+        "movdqa %%xmm5,     %%xmm7       \n\t"
+        "pcmpgtd %%xmm1,    %%xmm7       \n\t"
+        "movdqa %%xmm7,     %%xmm1       \n\t"
+        "movdqa %%xmm5,     %%xmm7       \n\t"
+        "pcmpgtd %%xmm2,    %%xmm7       \n\t"
+        "movdqa %%xmm7,     %%xmm2       \n\t"
+        "movdqa %%xmm5,     %%xmm7       \n\t"
+        "pcmpgtd %%xmm3,    %%xmm7       \n\t"
+        "movdqa %%xmm7,     %%xmm3       \n\t"
 
         /* pack mask into bytes */
         "packssdw %%xmm2,   %%xmm1       \n\t"
         "packssdw %%xmm3,   %%xmm3       \n\t"
         "packsswb %%xmm3,   %%xmm1       \n\t"
 
-        /* AND mask with lbp weight and sum the code */
-        "pand %%xmm6,       %%xmm1       \n\t"
+        /* AND NOT mask with lbp weight and sum the code */
+        "pandn %%xmm6,      %%xmm1       \n\t"
         "psadbw %%xmm1,     %%xmm0       \n\t"
 
         "movdqa %%xmm0,     %[m0]        \n\t"
@@ -167,34 +150,355 @@ lbp_classify_sse2(struct lbp_rect *r, struct weak_classifier *c, unsigned int *i
           [center] "m" (res.p[4]),
           [sign] "m" (*sign),
           [lbp_weight] "m" (*lbp_weight)
+        : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"
     );
     
-    int lbp_code = res.s[4] + res.s[0];
+    return res.s[4] + res.s[0];
+}
 
-    if (c->lbpmap[lbp_code >> 5] & (1 << (lbp_code & 31))) {
-        return c->neg;
-    } else {
-        return c->pos;
+struct lbp_classify_sse2 {
+    static inline int
+    code(const struct lbp_rect_geom *g, const unsigned int *img, int width)
+    {
+        return lbp_code_sse2(g, img, width);
     }
+};
+
+/* Multi-window evaluators: one weak classifier runs on 8 (AVX2) or 16 (AVX-512) windows
+ * of the same scale at once, the corners are gathered from every window origin.
+ * The sampling is done in double on the same box sums and with the same operation order
+ * as the plain c, no fused multiply-add, so the hits are the same. Windows go through the cascade stage by stage
+ * and the ones rejected are compacted out after every stage so the vectors stay full. */
+#ifdef CAN_COMPILE_AVX2
+/* unsigned to double, the integral image wraps at 32 bits */
+__attribute__((target("avx2"))) static inline __m256d
+cvtepu32_pd_avx2(__m128i x)
+{
+    const __m256d bias = _mm256_set1_pd(2147483648.0);
+    return _mm256_add_pd(_mm256_cvtepi32_pd(_mm_xor_si128(x, _mm_set1_epi32(0x80000000))), bias);
 }
 
-#define cpuid(func,ax,bx,cx,dx)\
-	__asm__ __volatile__ ("cpuid":\
-	"=a" (ax), "=b" (bx), "=c" (cx), "=d" (dx) : "a" (func));
-/* %edx */
-#define bit_SSE2        (1 << 26)
+__attribute__((target("avx2"))) static inline __m256d
+bilinear_pd_avx2(__m128i p0, __m128i p1, __m128i p2, __m128i p3, __m256d ax, __m256d bx, __m256d ay, __m256d by)
+{
+    __m256d top, bottom;
 
-static void lbp_detect_sse2_init(void)
+    top = _mm256_add_pd(_mm256_mul_pd(cvtepu32_pd_avx2(p0), ax), _mm256_mul_pd(cvtepu32_pd_avx2(p1), bx));
+    bottom = _mm256_add_pd(_mm256_mul_pd(cvtepu32_pd_avx2(p2), ax), _mm256_mul_pd(cvtepu32_pd_avx2(p3), bx));
+    return _mm256_add_pd(_mm256_mul_pd(top, ay), _mm256_mul_pd(bottom, by));
+}
+
+/* half h of the 8 windows */
+__attribute__((target("avx2"))) static inline __m128i
+half_avx2(__m256i x, int h)
 {
-    /* check if cpu support sse2 */
- 
-    unsigned int eax, ebx, ecx, edx;
-    
-    cpuid(1, eax, ebx, ecx, edx);
-    
-    if (edx & bit_SSE2) {
-        pf_lbp_classify = lbp_classify_sse2;
+    return h ? _mm256_extracti128_si256(x, 1) : _mm256_castsi256_si128(x);
+}
+
+/* the block sums of the 8 windows at origin, as the plain c get_interpolated_integral_value */
+__attribute__((target("avx2"))) static inline void
+get_block_sums_avx2(const struct lbp_rect_geom *g, const unsigned int *img, int width, __m256i origin, __m256i *p)
+{
+    const unsigned int *first = img + g->off_y[0];
+    __m256i top[8], d[2][8];
+    __m256d i[2][16];
+    __m128i sum[2][9];
+    int h, j, k, v;
+
+    for (j = 0; j < 8; j++)
+        top[j] = _mm256_i32gather_epi32((const int *)(first + g->off_x[j / 2] + j % 2), origin, 4);
+    for (k = 0; k < 4; k++) {
+        for (v = 0; v < 2; v++) {
+            const unsigned int *row = img + g->off_y[k] + v * width;
+            __m256i left = _mm256_sub_epi32(_mm256_i32gather_epi32((const int *)(row + g->off_x[0]), origin, 4), top[0]);
+            for (j = 0; j < 8; j++) {
+                __m256i q = _mm256_i32gather_epi32((const int *)(row + g->off_x[j / 2] + j % 2), origin, 4);
+                d[v][j] = _mm256_sub_epi32(_mm256_sub_epi32(q, top[j]), left);
+            }
+        }
+        for (j = 0; j < 4; j++) {
+            const __m256d ax = _mm256_set1_pd(g->ax[j]), bx = _mm256_set1_pd(g->bx[j]);
+            const __m256d ay = _mm256_set1_pd(g->ay[k]), by = _mm256_set1_pd(g->by[k]);
+            for (h = 0; h < 2; h++) {
+                i[h][k * 4 + j] = bilinear_pd_avx2(half_avx2(d[0][j * 2], h), half_avx2(d[0][j * 2 + 1], h),
+                        half_avx2(d[1][j * 2], h), half_avx2(d[1][j * 2 + 1], h), ax, bx, ay, by);
+            }
+        }
+    }
+
+    for (h = 0; h < 2; h++) {
+#define BLOCK_SUM(a, b, c, d) _mm256_cvttpd_epi32(_mm256_add_pd(_mm256_add_pd(_mm256_sub_pd(_mm256_sub_pd(i[h][a], i[h][b]), i[h][c]), i[h][d]), \
+            _mm256_set1_pd(0.5)))
+        sum[h][0] = BLOCK_SUM(0, 1, 4, 5);
+        sum[h][1] = BLOCK_SUM(1, 2, 5, 6);
+        sum[h][2] = BLOCK_SUM(2, 3, 6, 7);
+        sum[h][3] = BLOCK_SUM(4, 5, 8, 9);
+        sum[h][4] = BLOCK_SUM(5, 6, 9, 10);
+        sum[h][5] = BLOCK_SUM(6, 7, 10, 11);
+        sum[h][6] = BLOCK_SUM(8, 9, 12, 13);
+        sum[h][7] = BLOCK_SUM(9, 10, 13, 14);
+        sum[h][8] = BLOCK_SUM(10, 11, 14, 15);
+#undef BLOCK_SUM
+    }
+    for (j = 0; j < 9; j++)
+        p[j] = _mm256_inserti128_si256(_mm256_castsi128_si256(sum[0][j]), sum[1][j], 1);
+}
+
+/* all ones where a >= b, unsigned */
+__attribute__((target("avx2"))) static inline __m256i
+cmpge_epu32_avx2(__m256i a, __m256i b)
+{
+    return _mm256_cmpeq_epi32(_mm256_max_epu32(a, b), a);
+}
+
+__attribute__((target("avx2"))) static inline __m256
+lbp_classify_avx2(const struct lbp_rect_geom *g, const struct lbp_arena_stage *s, int c, const unsigned int *img, int width, __m256i origin, __m256i active)
+{
+    __m256i p[9], code, word, bit;
+
+    get_block_sums_avx2(g, img, width, origin, p);
+
+    code = _mm256_and_si256(cmpge_epu32_avx2(p[0], p[4]), _mm256_set1_epi32(128));
+    code = _mm256_or_si256(code, _mm256_and_si256(cmpge_epu32_avx2(p[1], p[4]), _mm256_set1_epi32(64)));
+    code = _mm256_or_si256(code, _mm256_and_si256(cmpge_epu32_avx2(p[2], p[4]), _mm256_set1_epi32(32)));
+    code = _mm256_or_si256(code, _mm256_and_si256(cmpge_epu32_avx2(p[3], p[4]), _mm256_set1_epi32(1)));
+    code = _mm256_or_si256(code, _mm256_and_si256(cmpge_epu32_avx2(p[5], p[4]), _mm256_set1_epi32(16)));
+    code = _mm256_or_si256(code, _mm256_and_si256(cmpge_epu32_avx2(p[6], p[4]), _mm256_set1_epi32(2)));
+    code = _mm256_or_si256(code, _mm256_and_si256(cmpge_epu32_avx2(p[7], p[4]), _mm256_set1_epi32(4)));
+    code = _mm256_or_si256(code, _mm256_and_si256(cmpge_epu32_avx2(p[8], p[4]), _mm256_set1_epi32(8)));
+
+    /* lbpmap[code >> 5] & (1 << (code & 31)), only for the live lanes */
+    word = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)lbp_arena_array(s, LBP_ARENA_LBPMAP) + c,
+            _mm256_mullo_epi32(_mm256_srli_epi32(code, 5), _mm256_set1_epi32(s->stride)), active, 4);
+    bit = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(code, _mm256_set1_epi32(31))), _mm256_set1_epi32(1));
+    return _mm256_blendv_ps(_mm256_set1_ps(((const float *)lbp_arena_array(s, LBP_ARENA_POS))[c]),
+            _mm256_set1_ps(((const float *)lbp_arena_array(s, LBP_ARENA_NEG))[c]),
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(bit, _mm256_set1_epi32(1))));
+}
+
+__attribute__((target("avx2"))) static int
+lbp_scan_batch_avx2(const struct lbp_data *data, const struct lbp_rect_geom *g, const unsigned int *img, int width, int *origin, int *idx, int n, struct face_eval_stats *stats)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const struct lbp_arena_stage *s = data->arena.s;
+    int i, j, b, k, alive;
+
+    for (i = 0; i < data->num_stages && n > 0; i++, s = lbp_arena_next(s)) {
+        const __m256 stage_threshold = _mm256_set1_ps(s->stage_threshold);
+        const float *reject = (const float *)lbp_arena_array(s, LBP_ARENA_REJECT);
+        const float *accept = (const float *)lbp_arena_array(s, LBP_ARENA_ACCEPT);
+        const int weak = s->num_weak_classifiers;
+
+        alive = 0;
+        for (b = 0; b < n; b += 8) {
+            int lanes = n - b < 8 ? n - b : 8;
+            __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(lanes), lane);
+            /* dead lanes read the first window again */
+            __m256i vorigin = _mm256_blendv_epi8(_mm256_set1_epi32(origin[b]),
+                    _mm256_maskload_epi32(origin + b, active), active);
+            __m256 threshold = _mm256_setzero_ps();
+            /* lanes still summing, the others have their outcome in pass */
+            int live = (1 << lanes) - 1, pass = 0;
+
+            for (j = 0; j < weak; j++) {
+                int rejected, accepted;
+
+                threshold = _mm256_add_ps(threshold, lbp_classify_avx2(&g[s->first + j], s, j, img, width, vorigin, active));
+                stats->evaluated += __builtin_popcount(live);
+                if (j == weak - 1)
+                    break;
+                rejected = _mm256_movemask_ps(_mm256_cmp_ps(threshold, _mm256_set1_ps(reject[j + 1]), _CMP_LT_OQ)) & live;
+                accepted = _mm256_movemask_ps(_mm256_cmp_ps(threshold, _mm256_set1_ps(accept[j + 1]), _CMP_GE_OQ)) & live;
+                if (rejected | accepted) {
+                    stats->early_rejects += __builtin_popcount(rejected);
+                    stats->early_accepts += __builtin_popcount(accepted);
+                    stats->skipped += __builtin_popcount(rejected | accepted) * (weak - j - 1);
+                    pass |= accepted;
+                    live &= ~(rejected | accepted);
+                    if (!live)
+                        break;
+                    active = _mm256_cmpgt_epi32(_mm256_and_si256(_mm256_set1_epi32(live), _mm256_sllv_epi32(_mm256_set1_epi32(1), lane)),
+                            _mm256_setzero_si256());
+                }
+            }
+            pass |= _mm256_movemask_ps(_mm256_cmp_ps(threshold, stage_threshold, _CMP_GE_OQ)) & live;
+            for (k = 0; k < lanes; k++) {
+                if (pass & (1 << k)) {
+                    origin[alive] = origin[b + k];
+                    idx[alive] = idx[b + k];
+                    alive++;
+                }
+            }
+        }
+        n = alive;
     }
+    return n;
+}
+#endif
+
+#ifdef CAN_COMPILE_AVX512
+__attribute__((target("avx512f,avx512bw"))) static inline __m512d
+bilinear_pd_avx512(__m256i p0, __m256i p1, __m256i p2, __m256i p3, __m512d ax, __m512d bx, __m512d ay, __m512d by)
+{
+    __m512d top, bottom;
+
+    top = _mm512_add_pd(_mm512_mul_pd(_mm512_cvtepu32_pd(p0), ax), _mm512_mul_pd(_mm512_cvtepu32_pd(p1), bx));
+    bottom = _mm512_add_pd(_mm512_mul_pd(_mm512_cvtepu32_pd(p2), ax), _mm512_mul_pd(_mm512_cvtepu32_pd(p3), bx));
+    return _mm512_add_pd(_mm512_mul_pd(top, ay), _mm512_mul_pd(bottom, by));
 }
 
+/* half h of the 16 windows */
+__attribute__((target("avx512f,avx512bw"))) static inline __m256i
+half_avx512(__m512i x, int h)
+{
+    return h ? _mm512_extracti64x4_epi64(x, 1) : _mm512_castsi512_si256(x);
+}
+
+/* the block sums of the 16 windows at origin, as the plain c get_interpolated_integral_value */
+__attribute__((target("avx512f,avx512bw"))) static inline void
+get_block_sums_avx512(const struct lbp_rect_geom *g, const unsigned int *img, int width, __m512i origin, __m512i *p)
+{
+    const unsigned int *first = img + g->off_y[0];
+    __m512i top[8], d[2][8];
+    __m512d i[2][16];
+    __m256i sum[2][9];
+    int h, j, k, v;
+
+    for (j = 0; j < 8; j++)
+        top[j] = _mm512_i32gather_epi32(origin, first + g->off_x[j / 2] + j % 2, 4);
+    for (k = 0; k < 4; k++) {
+        for (v = 0; v < 2; v++) {
+            const unsigned int *row = img + g->off_y[k] + v * width;
+            __m512i left = _mm512_sub_epi32(_mm512_i32gather_epi32(origin, row + g->off_x[0], 4), top[0]);
+            for (j = 0; j < 8; j++) {
+                __m512i q = _mm512_i32gather_epi32(origin, row + g->off_x[j / 2] + j % 2, 4);
+                d[v][j] = _mm512_sub_epi32(_mm512_sub_epi32(q, top[j]), left);
+            }
+        }
+        for (j = 0; j < 4; j++) {
+            const __m512d ax = _mm512_set1_pd(g->ax[j]), bx = _mm512_set1_pd(g->bx[j]);
+            const __m512d ay = _mm512_set1_pd(g->ay[k]), by = _mm512_set1_pd(g->by[k]);
+            for (h = 0; h < 2; h++) {
+                i[h][k * 4 + j] = bilinear_pd_avx512(half_avx512(d[0][j * 2], h), half_avx512(d[0][j * 2 + 1], h),
+                        half_avx512(d[1][j * 2], h), half_avx512(d[1][j * 2 + 1], h), ax, bx, ay, by);
+            }
+        }
+    }
+
+    for (h = 0; h < 2; h++) {
+#define BLOCK_SUM(a, b, c, d) _mm512_cvttpd_epi32(_mm512_add_pd(_mm512_add_pd(_mm512_sub_pd(_mm512_sub_pd(i[h][a], i[h][b]), i[h][c]), i[h][d]), \
+            _mm512_set1_pd(0.5)))
+        sum[h][0] = BLOCK_SUM(0, 1, 4, 5);
+        sum[h][1] = BLOCK_SUM(1, 2, 5, 6);
+        sum[h][2] = BLOCK_SUM(2, 3, 6, 7);
+        sum[h][3] = BLOCK_SUM(4, 5, 8, 9);
+        sum[h][4] = BLOCK_SUM(5, 6, 9, 10);
+        sum[h][5] = BLOCK_SUM(6, 7, 10, 11);
+        sum[h][6] = BLOCK_SUM(8, 9, 12, 13);
+        sum[h][7] = BLOCK_SUM(9, 10, 13, 14);
+        sum[h][8] = BLOCK_SUM(10, 11, 14, 15);
+#undef BLOCK_SUM
+    }
+    for (j = 0; j < 9; j++)
+        p[j] = _mm512_inserti64x4(_mm512_castsi256_si512(sum[0][j]), sum[1][j], 1);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static inline __m512
+lbp_classify_avx512(const struct lbp_rect_geom *g, const struct lbp_arena_stage *s, int c, const unsigned int *img, int width, __m512i origin, __mmask16 active)
+{
+    __m512i p[9], code, word, bit;
+
+    get_block_sums_avx512(g, img, width, origin, p);
+
+    code = _mm512_maskz_mov_epi32(_mm512_cmpge_epu32_mask(p[0], p[4]), _mm512_set1_epi32(128));
+    code = _mm512_mask_or_epi32(code, _mm512_cmpge_epu32_mask(p[1], p[4]), code, _mm512_set1_epi32(64));
+    code = _mm512_mask_or_epi32(code, _mm512_cmpge_epu32_mask(p[2], p[4]), code, _mm512_set1_epi32(32));
+    code = _mm512_mask_or_epi32(code, _mm512_cmpge_epu32_mask(p[3], p[4]), code, _mm512_set1_epi32(1));
+    code = _mm512_mask_or_epi32(code, _mm512_cmpge_epu32_mask(p[5], p[4]), code, _mm512_set1_epi32(16));
+    code = _mm512_mask_or_epi32(code, _mm512_cmpge_epu32_mask(p[6], p[4]), code, _mm512_set1_epi32(2));
+    code = _mm512_mask_or_epi32(code, _mm512_cmpge_epu32_mask(p[7], p[4]), code, _mm512_set1_epi32(4));
+    code = _mm512_mask_or_epi32(code, _mm512_cmpge_epu32_mask(p[8], p[4]), code, _mm512_set1_epi32(8));
 
+    /* lbpmap[code >> 5] & (1 << (code & 31)), only for the live lanes */
+    word = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active,
+            _mm512_mullo_epi32(_mm512_srli_epi32(code, 5), _mm512_set1_epi32(s->stride)), lbp_arena_array(s, LBP_ARENA_LBPMAP) + c, 4);
+    bit = _mm512_srlv_epi32(word, _mm512_and_si512(code, _mm512_set1_epi32(31)));
+    return _mm512_mask_blend_ps(_mm512_test_epi32_mask(bit, _mm512_set1_epi32(1)),
+            _mm512_set1_ps(((const float *)lbp_arena_array(s, LBP_ARENA_POS))[c]),
+            _mm512_set1_ps(((const float *)lbp_arena_array(s, LBP_ARENA_NEG))[c]));
+}
+
+__attribute__((target("avx512f,avx512bw"))) static int
+lbp_scan_batch_avx512(const struct lbp_data *data, const struct lbp_rect_geom *g, const unsigned int *img, int width, int *origin, int *idx, int n, struct face_eval_stats *stats)
+{
+    const struct lbp_arena_stage *s = data->arena.s;
+    int i, j, b, alive;
+
+    for (i = 0; i < data->num_stages && n > 0; i++, s = lbp_arena_next(s)) {
+        const __m512 stage_threshold = _mm512_set1_ps(s->stage_threshold);
+        const float *reject = (const float *)lbp_arena_array(s, LBP_ARENA_REJECT);
+        const float *accept = (const float *)lbp_arena_array(s, LBP_ARENA_ACCEPT);
+        const int weak = s->num_weak_classifiers;
+
+        alive = 0;
+        for (b = 0; b < n; b += 16) {
+            int lanes = n - b < 16 ? n - b : 16;
+            __mmask16 active = (__mmask16)((1u << lanes) - 1);
+            /* dead lanes read the first window again */
+            __m512i vorigin = _mm512_mask_loadu_epi32(_mm512_set1_epi32(origin[b]), active, origin + b);
+            __m512i vidx = _mm512_maskz_loadu_epi32(active, idx + b);
+            __m512 threshold = _mm512_setzero_ps();
+            /* lanes still summing, the others have their outcome in pass */
+            __mmask16 live = active, pass = 0;
+
+            for (j = 0; j < weak; j++) {
+                __mmask16 rejected, accepted;
+
+                threshold = _mm512_add_ps(threshold, lbp_classify_avx512(&g[s->first + j], s, j, img, width, vorigin, live));
+                stats->evaluated += __builtin_popcount(live);
+                if (j == weak - 1)
+                    break;
+                rejected = _mm512_mask_cmp_ps_mask(live, threshold, _mm512_set1_ps(reject[j + 1]), _CMP_LT_OQ);
+                accepted = _mm512_mask_cmp_ps_mask(live, threshold, _mm512_set1_ps(accept[j + 1]), _CMP_GE_OQ);
+                if (rejected | accepted) {
+                    stats->early_rejects += __builtin_popcount(rejected);
+                    stats->early_accepts += __builtin_popcount(accepted);
+                    stats->skipped += __builtin_popcount(rejected | accepted) * (weak - j - 1);
+                    pass |= accepted;
+                    live &= ~(rejected | accepted);
+                    if (!live)
+                        break;
+                }
+            }
+            pass |= _mm512_mask_cmp_ps_mask(live, threshold, stage_threshold, _CMP_GE_OQ);
+            /* alive never passes b, the group is already in registers */
+            _mm512_mask_compressstoreu_epi32(origin + alive, pass, vorigin);
+            _mm512_mask_compressstoreu_epi32(idx + alive, pass, vidx);
+            alive += __builtin_popcount(pass);
+        }
+        n = alive;
+    }
+    return n;
+}
+#endif
+
+static void lbp_detect_sse2_init(void)
+{
+    unsigned int flags = cpu_features();
+
+    /* check if cpu support sse2 */
+    if (flags & CPU_FEATURE_SSE2) {
+        pf_lbp_scan_depth_first = lbp_eval_depth_first<lbp_classify_sse2>;
+        pf_lbp_scan_batch = lbp_eval_stage_major<lbp_classify_sse2>;
+    }
+#ifdef CAN_COMPILE_AVX2
+    if (flags & CPU_FEATURE_AVX2) {
+        pf_lbp_scan_batch = lbp_scan_batch_avx2;
+    }
+#endif
+#ifdef CAN_COMPILE_AVX512
+    if (flags & CPU_FEATURE_AVX512) {
+        pf_lbp_scan_batch = lbp_scan_batch_avx512;
+    }
+#endif
+}
@@ -0,0 +1,237 @@
+/*
+ * facelbp - Face detection using Multi-scale Block Local Binary Pattern algorithm
+ *
+ * Copyright (C) 2013 Keith Mok <ek9852@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LBP_EVAL_H
+#define _LBP_EVAL_H
+
+#include "lbp.h"
+
+/* Cascade evaluators specialized at compile time on the sampling. C is a type with
+ *
+ *     static int code(const struct lbp_rect_geom *g, const unsigned int *win, int width);
+ *
+ * returning the lbp code of the rect g of one weak classifier, which is inlined into the
+ * loops; every ISA instantiates them in its own file and hands out whole evaluators
+ * (lbp_scan_batch_t) instead of a classifier. The cascade is read from the lbp_arena.
+ *
+ * Built with LBP_BUILTIN_CASCADE (configure --with-builtin-cascade) the cascade generated by
+ * facelbp_xml_converter -H is compiled in, the stage and weak classifier counts are then
+ * constants and the stages are unrolled; only the arena and num_stages of the lbp_data passed
+ * in are looked at.
+ *
+ * All of them stop after data->num_stages stages, which may be fewer than the cascade has. */
+
+/* the stage stopped before weak classifier j of n */
+static inline void
+lbp_eval_stop(struct face_eval_stats *stats, int j, int n, int pass)
+{
+    stats->evaluated += j;
+    stats->skipped += n - j;
+    if (pass)
+        stats->early_accepts++;
+    else
+        stats->early_rejects++;
+}
+
+/* whether the window passes stage s */
+template <class C>
+static inline int
+lbp_eval_stage(const struct lbp_arena_stage *s, const struct lbp_rect_geom *g, const unsigned int *win, int width, struct face_eval_stats *stats)
+{
+    const float *reject = (const float *)lbp_arena_array(s, LBP_ARENA_REJECT);
+    const float *accept = (const float *)lbp_arena_array(s, LBP_ARENA_ACCEPT);
+    int n = s->num_weak_classifiers;
+    float threshold = 0;
+    int j;
+
+    g += s->first;
+    for (j = 0; j < n - 1; j++) {
+        threshold += lbp_arena_weak(s, j, C::code(&g[j], win, width));
+        if (threshold < reject[j + 1]) {
+            lbp_eval_stop(stats, j + 1, n, 0);
+            return 0;
+        }
+        if (threshold >= accept[j + 1]) {
+            lbp_eval_stop(stats, j + 1, n, 1);
+            return 1;
+        }
+    }
+    threshold += lbp_arena_weak(s, j, C::code(&g[j], win, width));
+    stats->evaluated += n;
+    return threshold >= s->stage_threshold;
+}
+
+#ifndef LBP_BUILTIN_CASCADE
+
+template <class C>
+static inline int
+lbp_eval_window(const struct lbp_data *data, const struct lbp_rect_geom *g, const unsigned int *win, int width, struct face_eval_stats *stats)
+{
+    const struct lbp_arena_stage *s = data->arena.s;
+    int i;
+
+    for (i = 0; i < data->num_stages; i++, s = lbp_arena_next(s)) {
+        if (!lbp_eval_stage<C>(s, g, win, width, stats)) {
+            /* not matched */
+            return 0;
+        }
+    }
+    /* here we pass all the stages and found a match */
+    return 1;
+}
+
+/* breadth first, every window goes through a stage before any goes on to the next one */
+template <class C>
+static int
+lbp_eval_stage_major(const struct lbp_data *data, const struct lbp_rect_geom *g, const unsigned int *img, int width, int *origin, int *idx, int n, struct face_eval_stats *stats)
+{
+    const struct lbp_arena_stage *s = data->arena.s;
+    int alive, i, k;
+
+    for (i = 0; i < data->num_stages && n > 0; i++, s = lbp_arena_next(s)) {
+        alive = 0;
+        for (k = 0; k < n; k++) {
+            if (lbp_eval_stage<C>(s, g, img + origin[k], width, stats)) {
+                origin[alive] = origin[k];
+                idx[alive] = idx[k];
+                alive++;
+            }
+        }
+        n = alive;
+    }
+    return n;
+}
+
+#else
+#include LBP_BUILTIN_CASCADE
+
+/* one instance per stage S, the recursion ends at LBP_BUILTIN_NUM_STAGES.
+ * The early exit bounds still come from the arena stage s. */
+template <class C, int S>
+struct lbp_builtin_eval {
+    typedef lbp_builtin_stage<S> stage;
+
+    static inline int
+    pass(const struct lbp_arena_stage *s, const struct lbp_rect_geom *g, const unsigned int *win, int width, struct face_eval_stats *stats)
+    {
+        const struct weak_classifier *c = stage::classifiers();
+        const float *reject = (const float *)lbp_arena_array(s, LBP_ARENA_REJECT);
+        const float *accept = (const float *)lbp_arena_array(s, LBP_ARENA_ACCEPT);
+        const int n = stage::num_weak_classifiers;
+        float threshold = 0;
+        int j, code;
+
+        g += stage::first;
+        for (j = 0; j < n; j++) {
+            code = C::code(&g[j], win, width);
+            threshold += (c[j].lbpmap[code >> 5] & (1 << (code & 31))) ? c[j].neg : c[j].pos;
+            if (j == n - 1)
+                break;
+            if (threshold < reject[j + 1]) {
+                lbp_eval_stop(stats, j + 1, n, 0);
+                return 0;
+            }
+            if (threshold >= accept[j + 1]) {
+                lbp_eval_stop(stats, j + 1, n, 1);
+                return 1;
+            }
+        }
+        stats->evaluated += n;
+        return threshold >= stage::threshold();
+    }
+
+    /* stages is the number of stages run, at most LBP_BUILTIN_NUM_STAGES */
+    static inline int
+    window(int stages, const struct lbp_arena_stage *s, const struct lbp_rect_geom *g, const unsigned int *win, int width, struct face_eval_stats *stats)
+    {
+        if (S == stages)
+            return 1;
+        if (!pass(s, g, win, width, stats))
+            return 0;
+        return lbp_builtin_eval<C, S + 1>::window(stages, lbp_arena_next(s), g, win, width, stats);
+    }
+
+    static inline int
+    stage_major(int stages, const struct lbp_arena_stage *s, const struct lbp_rect_geom *g, const unsigned int *img, int width, int *origin, int *idx, int n, struct face_eval_stats *stats)
+    {
+        int alive = 0, k;
+
+        if (S == stages)
+            return n;
+        for (k = 0; k < n; k++) {
+            if (pass(s, g, img + origin[k], width, stats)) {
+                origin[alive] = origin[k];
+                idx[alive] = idx[k];
+                alive++;
+            }
+        }
+        if (!alive)
+            return 0;
+        return lbp_builtin_eval<C, S + 1>::stage_major(stages, lbp_arena_next(s), g, img, width, origin, idx, alive, stats);
+    }
+};
+
+template <class C>
+struct lbp_builtin_eval<C, LBP_BUILTIN_NUM_STAGES> {
+    static inline int
+    window(int stages, const struct lbp_arena_stage *s, const struct lbp_rect_geom *g, const unsigned int *win, int width, struct face_eval_stats *stats)
+    {
+        return 1;
+    }
+
+    static inline int
+    stage_major(int stages, const struct lbp_arena_stage *s, const struct lbp_rect_geom *g, const unsigned int *img, int width, int *origin, int *idx, int n, struct face_eval_stats *stats)
+    {
+        return n;
+    }
+};
+
+template <class C>
+static inline int
+lbp_eval_window(const struct lbp_data *data, const struct lbp_rect_geom *g, const unsigned int *win, int width, struct face_eval_stats *stats)
+{
+    return lbp_builtin_eval<C, 0>::window(data->num_stages, data->arena.s, g, win, width, stats);
+}
+
+template <class C>
+static int
+lbp_eval_stage_major(const struct lbp_data *data, const struct lbp_rect_geom *g, const unsigned int *img, int width, int *origin, int *idx, int n, struct face_eval_stats *stats)
+{
+    return lbp_builtin_eval<C, 0>::stage_major(data->num_stages, data->arena.s, g, img, width, origin, idx, n, stats);
+}
+
+#endif
+
+/* window by window, survivors compacted like the stage major one */
+template <class C>
+static int
+lbp_eval_depth_first(const struct lbp_data *data, const struct lbp_rect_geom *g, const unsigned int *img, int width, int *origin, int *idx, int n, struct face_eval_stats *stats)
+{
+    int alive = 0, k;
+
+    for (k = 0; k < n; k++) {
+        if (lbp_eval_window<C>(data, g, img + origin[k], width, stats)) {
+            origin[alive] = origin[k];
+            idx[alive] = idx[k];
+            alive++;
+        }
+    }
+    return alive;
+}
+
+#endif
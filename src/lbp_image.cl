@@ -24,12 +24,19 @@
 // CLX_FILTER_LINEAR on UINT32 is not support by opencl
 __constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
 
+/* same layout as struct lbp_range in lbp.h */
 typedef struct
 {
   int x;
   int y;
+  int step_x;
+  int step_y;
+  int grid_w;
+  int grid_h;
   float scale;
-} lbp_task;
+  int scale_idx;
+  uint first;
+} lbp_range;
 
 typedef struct {
   int x;
@@ -38,22 +45,26 @@ typedef struct {
   int h;
 } lbp_rect ;
 
-typedef struct {
-  int rect_idx;
-  int lbpmap[8];
-  float pos;
-  float neg;
-} weak_classifier;
+/* same layout as struct lbp_arena in lbp.h, a stage header then its classifiers
+ * as arrays stride words long */
+#define ARENA_POS 0
+#define ARENA_NEG 1
+#define ARENA_LBPMAP 2
+#define ARENA_RECT_X 10
+#define ARENA_RECT_Y 11
+#define ARENA_RECT_W 12
+#define ARENA_RECT_H 13
 
 typedef struct {
   float stage_threshold;
   int num_weak_classifiers;
-  int classifier_start_index;
-} stage;
+  int first;
+  int stride;
+  int next;
+} arena_stage;
 
 void get_interpolated_integral_value(
-    __global const lbp_rect *r,
-    __global const weak_classifier *c,
+    const lbp_rect *r,
     image2d_t img,
     int x,
     int y,
@@ -105,8 +116,9 @@ void get_interpolated_integral_value(
 }
 
 float lbp_classify(
-    __global const lbp_rect *r,
-    __global const weak_classifier *c,
+    __global const int *a,
+    int stride,
+    int c,
     image2d_t img,
     int x,
     int y,
@@ -119,8 +131,14 @@ float lbp_classify(
   uint8 p;
   uint center;
   int lbp_code;
+  lbp_rect r;
+
+  r.x = a[ARENA_RECT_X * stride + c];
+  r.y = a[ARENA_RECT_Y * stride + c];
+  r.w = a[ARENA_RECT_W * stride + c];
+  r.h = a[ARENA_RECT_H * stride + c];
 
-  get_interpolated_integral_value(&r[c->rect_idx], c, img, x, y, scale, &p, &center);
+  get_interpolated_integral_value(&r, img, x, y, scale, &p, &center);
 
   lbp_code = 0;
   if (p.s0 >= center) lbp_code |= 128;
@@ -132,18 +150,17 @@ float lbp_classify(
   if (p.s6 >= center) lbp_code |= 4;
   if (p.s7 >= center) lbp_code |= 8;
 
-  if (c->lbpmap[lbp_code >> 5] & (1 << (lbp_code & 31))) {
-    return c->neg;
+  if (a[(ARENA_LBPMAP + (lbp_code >> 5)) * stride + c] & (1 << (lbp_code & 31))) {
+    return as_float(a[ARENA_NEG * stride + c]);
   } else {
-    return c->pos;
+    return as_float(a[ARENA_POS * stride + c]);
   }
 }
 
 __kernel void lbp(
-    __global const lbp_rect *rect,
-    __global const weak_classifier *c,
-    __global const stage *s,
-    __global const lbp_task *t,
+    __global const int *arena,
+    __global const lbp_range *ranges,
+    int num_ranges,
 #if __OPENCL_VERSION__ == 100
     __global unsigned int *result_counter,
 #else
@@ -153,18 +170,34 @@ __kernel void lbp(
     image2d_t img // input integral image
     )
 {
-  int gid = get_global_id(0);
+  uint gid = get_global_id(0);
+  __global const int *s = arena;
+  int lo = 0, hi = num_ranges;
+
+  /* the window is worked out from the range holding gid, the last one starting at or
+   * before it */
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (ranges[mid].first <= gid)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  __global const lbp_range *r = &ranges[lo - 1];
+  int x = r->x + (gid - r->first) / r->grid_h * r->step_x;
+  int y = r->y + (gid - r->first) % r->grid_h * r->step_y;
 
   for (int i = 0; i < NUM_STAGES; i++) {
+    __global const arena_stage *h = (__global const arena_stage *)s;
     /* loop all weak classifiers */
     float threshold = 0;
-    int start_idx = s[i].classifier_start_index;
-    for (int j = 0; j < s[i].num_weak_classifiers; j++) {
-      threshold += lbp_classify(rect, &c[start_idx + j], img, t[gid].x, t[gid].y, t[gid].scale);
+    for (int j = 0; j < h->num_weak_classifiers; j++) {
+      threshold += lbp_classify(s + ARENA_LINE, h->stride, j, img, x, y, r->scale);
     }
-    if (threshold < s[i].stage_threshold) {
+    if (threshold < h->stage_threshold) {
       return;
     }
+    s += h->next;
   }
 #if __OPENCL_VERSION__ == 100
   unsigned int ind = atom_inc(result_counter);
@@ -0,0 +1,286 @@
+/*
+ * facelbp - Face detection using Multi-scale Block Local Binary Pattern algorithm
+ *
+ * Copyright (C) 2013 Keith Mok <ek9852@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "thread_pool.h"
+#include "common.h"
+
+/* chunks [begin, end) still to run, begin in the low half. The owner takes from the
+ * front and thieves take from the back, both by compare and swap of the whole word */
+#define RANGE(begin, end) (((uint64_t)(end) << 32) | (uint32_t)(begin))
+#define RANGE_BEGIN(r) ((int)(uint32_t)(r))
+#define RANGE_END(r) ((int)((r) >> 32))
+
+/* one cache line each, the ranges are hammered by every thread */
+struct thread_pool_worker {
+    uint64_t range;
+    struct thread_pool *pool;
+    pthread_t thread;
+    int index;
+    int cpu; /* -1 for any */
+    int pinned; /* cpu the thread runs on now */
+} __attribute__((aligned(64)));
+
+struct thread_pool {
+    struct thread_pool_worker *workers;
+    int threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned int generation; /* bumped for every run */
+    int running; /* helper threads still in the run */
+    int quit;
+    thread_pool_fn_t fn;
+    void *priv;
+};
+
+/* next chunk of the own range, -1 once it is empty */
+static int
+take_chunk(struct thread_pool_worker *w)
+{
+    uint64_t r = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+
+    while (RANGE_BEGIN(r) < RANGE_END(r)) {
+        if (__atomic_compare_exchange_n(&w->range, &r, RANGE(RANGE_BEGIN(r) + 1, RANGE_END(r)),
+                false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return RANGE_BEGIN(r);
+    }
+    return -1;
+}
+
+/* moves the back half of another thread's range to w, 0 once there is nothing left */
+static int
+steal_chunks(struct thread_pool *p, struct thread_pool_worker *w)
+{
+    int i;
+
+    for (i = 1; i < p->threads; i++) {
+        struct thread_pool_worker *v = &p->workers[(w->index + i) % p->threads];
+        uint64_t r = __atomic_load_n(&v->range, __ATOMIC_ACQUIRE);
+
+        while (RANGE_BEGIN(r) < RANGE_END(r)) {
+            int n = (RANGE_END(r) - RANGE_BEGIN(r) + 1) / 2;
+            int split = RANGE_END(r) - n;
+
+            if (__atomic_compare_exchange_n(&v->range, &r, RANGE(RANGE_BEGIN(r), split),
+                    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                /* only thieves look at an empty range, and they leave it alone */
+                __atomic_store_n(&w->range, RANGE(split, split + n), __ATOMIC_RELEASE);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void
+run_chunks(struct thread_pool *p, struct thread_pool_worker *w)
+{
+    int chunk;
+
+    do {
+        while ((chunk = take_chunk(w)) >= 0)
+            p->fn(p->priv, w->index, chunk);
+    } while (steal_chunks(p, w));
+}
+
+static void
+pin_worker(struct thread_pool_worker *w)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    int i;
+
+    CPU_ZERO(&set);
+    if (w->cpu >= 0) {
+        CPU_SET(w->cpu, &set);
+    } else {
+        for (i = 0; i < CPU_SETSIZE; i++)
+            CPU_SET(i, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set))
+        ALOGW("Cannot pin thread %d to cpu %d", w->index, w->cpu);
+#endif
+    w->pinned = w->cpu;
+}
+
+static void *
+worker_main(void *arg)
+{
+    struct thread_pool_worker *w = (struct thread_pool_worker *)arg;
+    struct thread_pool *p = w->pool;
+    unsigned int generation = 0;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->quit && p->generation == generation)
+            pthread_cond_wait(&p->start, &p->lock);
+        if (p->quit)
+            break;
+        generation = p->generation;
+        pthread_mutex_unlock(&p->lock);
+
+        if (w->cpu != w->pinned)
+            pin_worker(w);
+        run_chunks(p, w);
+
+        pthread_mutex_lock(&p->lock);
+        if (--p->running == 0)
+            pthread_cond_signal(&p->done);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+int
+thread_pool_cpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+}
+
+struct thread_pool *
+thread_pool_create(int threads)
+{
+    struct thread_pool *p;
+    void *workers;
+    int i;
+
+    if (threads < 1)
+        return NULL;
+    p = (struct thread_pool *)calloc(1, sizeof(*p));
+    if (!p)
+        return NULL;
+    if (posix_memalign(&workers, 64, threads * sizeof(struct thread_pool_worker))) {
+        free(p);
+        return NULL;
+    }
+    p->workers = (struct thread_pool_worker *)workers;
+    memset(p->workers, 0, threads * sizeof(struct thread_pool_worker));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    for (i = 0; i < threads; i++) {
+        struct thread_pool_worker *w = &p->workers[i];
+
+        w->pool = p;
+        w->index = i;
+        w->cpu = -1;
+        w->pinned = -1;
+        /* thread 0 is whoever calls thread_pool_run */
+        if (i && pthread_create(&w->thread, NULL, worker_main, w)) {
+            ALOGE("Cannot create pool thread %d", i);
+            thread_pool_destroy(p);
+            return NULL;
+        }
+        p->threads = i + 1;
+    }
+    return p;
+}
+
+void
+thread_pool_destroy(struct thread_pool *p)
+{
+    int i;
+
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+    for (i = 1; i < p->threads; i++)
+        pthread_join(p->workers[i].thread, NULL);
+
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->start);
+    pthread_mutex_destroy(&p->lock);
+    free(p->workers);
+    free(p);
+}
+
+int
+thread_pool_threads(const struct thread_pool *p)
+{
+    return p->threads;
+}
+
+int
+thread_pool_set_affinity(struct thread_pool *p, const int *cpus, int num_cpus)
+{
+#ifdef __linux__
+    int i;
+
+    if (cpus && num_cpus <= 0)
+        return -EINVAL;
+    for (i = 0; cpus && i < num_cpus; i++) {
+        if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE)
+            return -EINVAL;
+    }
+    /* the threads pin themselves when they wake up for the next run */
+    pthread_mutex_lock(&p->lock);
+    for (i = 1; i < p->threads; i++)
+        p->workers[i].cpu = cpus ? cpus[(i - 1) % num_cpus] : -1;
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+#else
+    return cpus ? -ENOSYS : 0;
+#endif
+}
+
+void
+thread_pool_run(struct thread_pool *p, int chunks, thread_pool_fn_t fn, void *priv)
+{
+    int i;
+
+    if (chunks <= 0)
+        return;
+    if (p->threads == 1 || chunks == 1) {
+        for (i = 0; i < chunks; i++)
+            fn(priv, 0, i);
+        return;
+    }
+
+    /* even shares to start with, the stealing evens out what the chunks cost */
+    for (i = 0; i < p->threads; i++) {
+        p->workers[i].range = RANGE((long)chunks * i / p->threads, (long)chunks * (i + 1) / p->threads);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->fn = fn;
+    p->priv = priv;
+    p->running = p->threads - 1;
+    p->generation++;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    run_chunks(p, &p->workers[0]);
+
+    pthread_mutex_lock(&p->lock);
+    while (p->running)
+        pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
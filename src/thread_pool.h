@@ -0,0 +1,43 @@
+/*
+ * facelbp - Face detection using Multi-scale Block Local Binary Pattern algorithm
+ *
+ * Copyright (C) 2013 Keith Mok <ek9852@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+/* Persistent worker threads, independent of OpenMP. A run hands every thread an even share
+ * of the chunks, a thread that runs out steals half of what is left to another one, so
+ * chunks of very uneven cost still keep every thread busy. The calling thread is thread 0. */
+
+struct thread_pool;
+
+/* body of a run, chunk in [0, chunks) is run once by thread in [0, threads) */
+typedef void (*thread_pool_fn_t) (void *priv, int thread, int chunk);
+
+struct thread_pool *thread_pool_create(int threads);
+void thread_pool_destroy(struct thread_pool *p);
+int thread_pool_threads(const struct thread_pool *p);
+/* pins thread i (1 to threads - 1) to cpus[(i - 1) % num_cpus], NULL unpins them.
+ * The calling thread is left alone. -ENOSYS where threads cannot be pinned */
+int thread_pool_set_affinity(struct thread_pool *p, const int *cpus, int num_cpus);
+/* returns once every chunk is done */
+void thread_pool_run(struct thread_pool *p, int chunks, thread_pool_fn_t fn, void *priv);
+
+/* processors online, at least 1 */
+int thread_pool_cpus(void);
+
+#endif